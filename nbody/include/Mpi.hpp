@@ -2,6 +2,7 @@
 #pragma once
 
 #include <mpi.h>
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -31,9 +32,15 @@ class Mpi {
   
  public:
   Mpi(int& argc, char**& argv) {
-    if (MPI_Init(&argc, &argv) != MPI_SUCCESS) {
+    // Threads share parallel regions with MPI calls, made by the main thread
+    int provided = MPI_THREAD_SINGLE;
+    if (MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided)
+        != MPI_SUCCESS) {
       throw Error("could not init MPI");
     }
+    if (provided < MPI_THREAD_FUNNELED) {
+      throw Error("MPI does not support threads");
+    }
     if (MPI_Comm_rank(MPI_COMM_WORLD, &this->processNumber) != MPI_SUCCESS) {
       throw Error("could not get MPI rank");
     }
@@ -173,6 +180,48 @@ class Mpi {
     }
   }
 
+ public:  // Nonblocking
+  /// Start sending count values to another process without waiting. The
+  /// values must not be modified until the returned request is waited
+  template <typename Type>
+  MPI_Request sendAsync(const Type* values, const int count,
+      const int toProcess, const int tag = 0) {
+    MPI_Request request = MPI_REQUEST_NULL;
+    if (MPI_Isend(values, count, Mpi::map(Type()), toProcess, tag,
+        MPI_COMM_WORLD, &request) != MPI_SUCCESS) {
+      throw Mpi::Error("could not start sending array", *this);
+    }
+    return request;
+  }
+  /// Start receiving at most capacity values from another process without
+  /// waiting. The values are only valid after the request is waited
+  template <typename Type>
+  MPI_Request receiveAsync(Type* values, const int capacity,
+      const int fromProcess, const int tag = MPI_ANY_TAG) {
+    MPI_Request request = MPI_REQUEST_NULL;
+    if (MPI_Irecv(values, capacity, Mpi::map(Type()), fromProcess, tag,
+        MPI_COMM_WORLD, &request) != MPI_SUCCESS) {
+      throw Mpi::Error("could not start receiving array", *this);
+    }
+    return request;
+  }
+  /// Wait until all the given requests complete
+  void waitAll(MPI_Request* requests, const int count) {
+    if (MPI_Waitall(count, requests, MPI_STATUSES_IGNORE) != MPI_SUCCESS) {
+      throw Mpi::Error("could not wait for requests", *this);
+    }
+  }
+  /// Check without blocking if all the given requests completed, which also
+  /// progresses their transfers. Completed requests become MPI_REQUEST_NULL
+  bool testAll(MPI_Request* requests, const int count) {
+    int completed = 0;
+    if (MPI_Testall(count, requests, &completed, MPI_STATUSES_IGNORE)
+        != MPI_SUCCESS) {
+      throw Mpi::Error("could not test requests", *this);
+    }
+    return completed;
+  }
+
  public:
   void barrier() {
     if (MPI_Barrier(MPI_COMM_WORLD) != MPI_SUCCESS) {
@@ -212,6 +261,67 @@ class Mpi {
     }
   }
 
+ public:
+  /// Gather a scalar value from every process into all processes, ordered
+  /// by rank
+  template <typename Type>
+  void allGather(const Type& value, std::vector<Type>& values) {
+    values.resize(this->size());
+    if (MPI_Allgather(&value, /*count*/ 1, Mpi::map(value), values.data(),
+        /*count*/ 1, Mpi::map(value), MPI_COMM_WORLD) != MPI_SUCCESS) {
+      throw Mpi::Error("could not all-gather", *this);
+    }
+  }
+
+  /// Gather arrays of different sizes from every process into all
+  /// processes, concatenated by rank. The values of process p are in
+  /// [offsets[p], offsets[p + 1][ of gathered
+  template <typename Type>
+  void allGatherv(const std::vector<Type>& values, std::vector<Type>& gathered,
+      std::vector<int>& offsets) {
+    std::vector<int> counts;
+    this->allGather(static_cast<int>(values.size()), counts);
+    offsets.resize(counts.size() + 1);
+    offsets[0] = 0;
+    for (size_t process = 0; process < counts.size(); ++process) {
+      offsets[process + 1] = offsets[process] + counts[process];
+    }
+    gathered.resize(offsets.back());
+    if (MPI_Allgatherv(values.data(), counts[this->rank()], Mpi::map(Type()),
+        gathered.data(), counts.data(), offsets.data(), Mpi::map(Type()),
+        MPI_COMM_WORLD) != MPI_SUCCESS) {
+      throw Mpi::Error("could not all-gather vector", *this);
+    }
+  }
+
+  /// Send a different part of values to every process. The first counts[0]
+  /// values go to process 0, the next counts[1] to process 1, and so on.
+  /// Received values are concatenated by rank of the sender
+  template <typename Type>
+  void allToAllv(const std::vector<Type>& values,
+      const std::vector<int>& counts, std::vector<Type>& received) {
+    std::vector<int> receiveCounts(this->size());
+    if (MPI_Alltoall(counts.data(), /*count*/ 1, MPI_INT,
+        receiveCounts.data(), /*count*/ 1, MPI_INT, MPI_COMM_WORLD)
+        != MPI_SUCCESS) {
+      throw Mpi::Error("could not exchange counts", *this);
+    }
+    std::vector<int> offsets(this->size(), 0);
+    std::vector<int> receiveOffsets(this->size(), 0);
+    for (int process = 1; process < this->size(); ++process) {
+      offsets[process] = offsets[process - 1] + counts[process - 1];
+      receiveOffsets[process] = receiveOffsets[process - 1] +
+        receiveCounts[process - 1];
+    }
+    received.resize(receiveOffsets.back() + receiveCounts.back());
+    if (MPI_Alltoallv(values.data(), counts.data(), offsets.data(),
+        Mpi::map(Type()), received.data(), receiveCounts.data(),
+        receiveOffsets.data(), Mpi::map(Type()), MPI_COMM_WORLD)
+        != MPI_SUCCESS) {
+      throw Mpi::Error("could not exchange vectors", *this);
+    }
+  }
+
  public:
   template <typename Type>
   void reduce(const Type& value, Type& result, const int operation,
@@ -253,4 +363,75 @@ class Mpi {
       throw Error("could not all-reduce vector", *this);
     }
   }
+
+  /// All-reduce records of recordSize doubles that MPI cannot combine by
+  /// itself, such as partial statistics. The function receives arrays of
+  /// records and must be the same in every process
+  void allReduce(std::vector<double>& values,
+      std::vector<double>& receiveValues, const int recordSize,
+      MPI_User_function* function) {
+    MPI_Datatype record;
+    MPI_Type_contiguous(recordSize, MPI_DOUBLE, &record);
+    MPI_Type_commit(&record);
+    MPI_Op operation;
+    MPI_Op_create(function, /*commute*/ 1, &operation);
+    const int result = MPI_Allreduce(values.data(), receiveValues.data(),
+      static_cast<int>(values.size()) / recordSize, record, operation,
+      MPI_COMM_WORLD);
+    MPI_Op_free(&operation);
+    MPI_Type_free(&record);
+    if (result != MPI_SUCCESS) {
+      throw Error("could not all-reduce records", *this);
+    }
+  }
+
+  /// Combine the values of the processes before this one. The first process
+  /// gets the identity of the operation, which must be given
+  template <typename Type>
+  void exclusiveScan(const Type& value, Type& result, const MPI_Op operation,
+      const Type& identity) {
+    if (MPI_Exscan(&value, &result, /*count*/ 1, Mpi::map(value), operation,
+        MPI_COMM_WORLD) != MPI_SUCCESS) {
+      throw Mpi::Error("could not scan", *this);
+    }
+    if (this->rank() == 0) {
+      result = identity;  // MPI_Exscan leaves the first result undefined
+    }
+  }
+
+ public:  // File output
+  /// Write the data of every process to a file, concatenated by rank, with
+  /// collective MPI-IO. Each process finds where its part starts with an
+  /// exclusive prefix sum of the sizes, so all of them write at once
+  void writeOrdered(const std::string& fileName, const char* data,
+      size_t size) {
+    long long partSize = static_cast<long long>(size);
+    long long offset = 0;
+    this->exclusiveScan(partSize, offset, MPI_SUM, 0ll);
+    long long fileSize = 0;
+    this->allReduce(partSize, fileSize, MPI_SUM);
+    // MPI counts are ints, so large parts go in chunks. The writes are
+    // collective, so every process makes as many as the largest part needs
+    const long long chunkSize = 1ll << 30;
+    long long chunkCount = 0;
+    this->allReduce((partSize + chunkSize - 1) / chunkSize, chunkCount,
+      MPI_MAX);
+    MPI_File file;
+    if (MPI_File_open(MPI_COMM_WORLD, fileName.c_str(), MPI_MODE_CREATE
+        | MPI_MODE_WRONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS) {
+      throw Mpi::Error("could not open " + fileName, *this);
+    }
+    // Cut what an older and longer file had after the new contents
+    bool written = MPI_File_set_size(file, fileSize) == MPI_SUCCESS;
+    for (long long chunk = 0; chunk < chunkCount; ++chunk) {
+      const long long start = std::min(chunk * chunkSize, partSize);
+      const long long count = std::min(chunkSize, partSize - start);
+      written = MPI_File_write_at_all(file, offset + start, data + start,
+        static_cast<int>(count), MPI_CHAR, MPI_STATUS_IGNORE) == MPI_SUCCESS
+        && written;
+    }
+    if (MPI_File_close(&file) != MPI_SUCCESS || !written) {
+      throw Mpi::Error("could not write " + fileName, *this);
+    }
+  }
 };
@@ -3,6 +3,7 @@
 #ifndef UTIL_HPP
 #define UTIL_HPP
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -23,6 +24,24 @@ class Util {
   static int random(int min, int max);
   /// Generates a pseudo-random real number in range [min, max[
   static double random(double min, double max);
+  /// Scrambles the bits of a number (finalizer of SplitMix64), so close
+  /// numbers give unrelated results
+  static inline uint64_t mixBits(uint64_t bits) {
+    bits = (bits ^ (bits >> 30)) * 0xBF58476D1CE4E5B9ull;
+    bits = (bits ^ (bits >> 27)) * 0x94D049BB133111EBull;
+    return bits ^ (bits >> 31);
+  }
+  /// Generates a pseudo-random real number in range [min, max[ that only
+  /// depends on a key and a counter. Threads draw any counter in any order
+  /// without sharing an engine, and always get the same numbers
+  /// @param key Scrambled seed of the stream, see mixBits()
+  /// @param counter Position of the number in the stream
+  static inline double random(uint64_t key, uint64_t counter, double min,
+      double max) {
+    const uint64_t bits = Util::mixBits(key + counter * 0x9E3779B97F4A7C15ull);
+    // The 53 high bits fill the mantissa of a double in [0, 1[
+    return min + (max - min) * (static_cast<double>(bits >> 11) * 0x1.0p-53);
+  }
 
  public:  // Concurrency
   /**
@@ -19,6 +19,7 @@
 #define BODY_ACCELERATION_DATA_SIZE 4
 #define BODY_DISTANCE_DATA_SIZE 3
 #define BODY_VELOCITY_DATA_SIZE 3
+#define BODY_MIGRATION_DATA_SIZE 10
 
 /// @brief Collision data indexes for serialized bodies
 enum CollisionData{
@@ -32,6 +33,13 @@ enum CollisionData{
   COLLISION_VELOCITY_Z = 7
 };
 
+/// @brief Data of a body moved between processes: its collision data, then
+/// its position in the universe file and its time bin
+enum MigrationData{
+  MIGRATION_ID = BODY_COLLISION_DATA_SIZE,
+  MIGRATION_TIME_BIN = BODY_COLLISION_DATA_SIZE + 1
+};
+
 /// @brief Acceleration data indexes for serialized bodies
 enum AccelerationData{
   ACCELERATION_MASS = 0,
@@ -40,11 +48,66 @@ enum AccelerationData{
   ACCELERATION_POSITION_Z = 3
 };
 
+// Binary universe files start with these 8 bytes and the 64 bits bodies
+// count, followed by BODY_COLLISION_DATA_SIZE doubles per body
+#define BINARY_UNIVERSE_MAGIC "NBODYU01"
+#define BINARY_UNIVERSE_MAGIC_SIZE 8
+#define BINARY_UNIVERSE_HEADER_SIZE 16
+
+// Checkpoint files start with these 8 bytes, see CheckpointHeader
+#define CHECKPOINT_MAGIC "NBODYK01"
+#define CHECKPOINT_MAGIC_SIZE 8
+
+// Trajectory files start with these 8 bytes, see TrajectoryWriter
+#define TRAJECTORY_MAGIC "NBODYT01"
+#define TRAJECTORY_MAGIC_SIZE 8
+// Frames a process may have waiting for its trajectory writer
+#define TRAJECTORY_QUEUE_CAPACITY 4
+
 // Excution modes for the simulation
 enum ExecutionMode {
   UNIVERSE_FILE_MODE, RANDOM_UNIVERSE_MODE
 };
 
+// Methods to compute gravitational accelerations
+enum ForceMode {
+  FORCE_DIRECT, FORCE_SYMMETRIC, FORCE_BARNES_HUT
+};
+
+// Ways processes share their bodies with each other
+enum ExchangeMode {
+  EXCHANGE_BROADCAST, EXCHANGE_RING, EXCHANGE_ALLGATHER, EXCHANGE_FUSED
+};
+
+// Floating point precision of direct accelerations
+enum Precision {
+  PRECISION_DOUBLE, PRECISION_MIXED
+};
+
+// Ways of progressing the transfers of the ring exchange
+enum Progress {
+  PROGRESS_WAIT, PROGRESS_THREAD
+};
+
+// Ways of computing the statistics of the distances between bodies
+enum StatisticsMode {
+  STATISTICS_CLOSED, STATISTICS_PAIRS
+};
+
+// Methods to advance velocities and positions
+enum Integrator {
+  INTEGRATOR_EULER, INTEGRATOR_LEAPFROG
+};
+
+// Default opening angle for Barnes-Hut approximation
+#define DEFAULT_THETA 0.5
+
+// Cells per axis of the Morton curve, 21 bits each fit a 64 bits key
+#define MORTON_CELLS (1ull << 21)
+
+// Default accuracy factor for choosing the time bins of bodies
+#define DEFAULT_TIME_BIN_ETA 0.1
+
 // Common arguments positions for indexing
 enum CommonArgumentsPositions {
   DELTA_T = 2, MAX_TIME
@@ -68,6 +131,11 @@ enum RandomUniverseModePositions {
 #define DEFAULT_MIN_VEL -1000.0
 #define DEFAULT_MAX_VEL 1000.0
 
+// Size of a serialized mass change, see Universe::serializeMassChanges
+#define BODY_MASS_CHANGE_SIZE 2
+// Size of a serialized velocity change, see Universe::advanceTimeBins
+#define BODY_VELOCITY_CHANGE_SIZE 4
+
 // MPI tags
 #define COLLISION_TAG 100
 #define ACCELERATION_TAG 101
@@ -0,0 +1,163 @@
+// Copyright 2025 Stockholm Syndrome. Universidad de Costa Rica. CC BY 4.0
+
+#include "Checkpoint.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+Checkpoint::~Checkpoint() {
+  if (!this->writer.joinable()) {
+    return;  // No checkpoint was taken
+  }
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->changed.wait(lock, [this] { return !this->pending; });
+    this->stopping = true;
+  }
+  this->changed.notify_all();
+  this->writer.join();
+}
+
+std::string Checkpoint::getFileName(const std::string& stem,
+    uint64_t generation, uint64_t rank) {
+  return stem + "-checkpoint-" + std::to_string(generation) + "-" +
+    std::to_string(rank) + ".bin";
+}
+
+void Checkpoint::write(const std::string& fileName,
+    const CheckpointHeader& header, std::vector<double>& records) {
+  if (!this->writer.joinable()) {
+    this->writer = std::thread(&Checkpoint::run, this);
+  }
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->changed.wait(lock, [this] { return !this->pending; });
+    if (!this->error.empty()) {
+      throw std::runtime_error(this->error);
+    }
+    this->fileName = fileName;
+    this->header = header;
+    this->header.recordCount = records.size() / BODY_MIGRATION_DATA_SIZE;
+    this->records.swap(records);
+    this->pending = true;
+  }
+  this->changed.notify_all();
+}
+
+void Checkpoint::wait() {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  this->changed.wait(lock, [this] { return !this->pending; });
+  if (!this->error.empty()) {
+    throw std::runtime_error(this->error);
+  }
+}
+
+void Checkpoint::run() {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  while (true) {
+    this->changed.wait(lock, [this] {
+      return this->pending || this->stopping;
+    });
+    if (!this->pending) {
+      break;  // Stopping
+    }
+    // The caller may fill its own buffer meanwhile, but not hand it over
+    lock.unlock();
+    const std::string result = Checkpoint::writeFile(this->fileName,
+      this->header, this->records);
+    lock.lock();
+    this->error = result;
+    this->pending = false;
+    this->changed.notify_all();
+  }
+}
+
+std::string Checkpoint::writeFile(const std::string& fileName,
+    const CheckpointHeader& header, const std::vector<double>& records) {
+  const std::string temporaryName = fileName + ".tmp";
+  std::ofstream file(temporaryName, std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char*>(&header), sizeof header);
+  file.write(reinterpret_cast<const char*>(records.data()),
+    records.size() * sizeof(double));
+  file.close();
+  if (!file) {
+    return "could not write checkpoint " + temporaryName;
+  }
+  if (std::rename(temporaryName.c_str(), fileName.c_str()) != 0) {
+    return "could not rename checkpoint " + temporaryName;
+  }
+  return "";
+}
+
+bool Checkpoint::readHeader(const std::string& fileName,
+    CheckpointHeader& header) {
+  std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+  const std::streamoff fileSize = file.tellg();
+  file.seekg(0);
+  file.read(reinterpret_cast<char*>(&header), sizeof header);
+  return file && std::memcmp(header.magic, CHECKPOINT_MAGIC,
+    CHECKPOINT_MAGIC_SIZE) == 0 && static_cast<uint64_t>(fileSize) ==
+    sizeof header + header.recordCount * BODY_MIGRATION_DATA_SIZE *
+    sizeof(double);
+}
+
+bool Checkpoint::findLatest(const std::string& stem,
+    CheckpointHeader& latest) {
+  bool found = false;
+  for (uint64_t generation = 0; generation < 2; ++generation) {
+    CheckpointHeader first = {};
+    if (!Checkpoint::readHeader(Checkpoint::getFileName(stem, generation, 0),
+        first) || (found && first.number <= latest.number)) {
+      continue;
+    }
+    // Every process must have finished this checkpoint
+    bool complete = true;
+    uint64_t recordCount = 0;
+    for (uint64_t rank = 0; rank < first.processCount && complete; ++rank) {
+      CheckpointHeader other = {};
+      complete = Checkpoint::readHeader(Checkpoint::getFileName(stem,
+        generation, rank), other) && other.number == first.number &&
+        other.processCount == first.processCount &&
+        other.bodyCount == first.bodyCount;
+      recordCount += other.recordCount;
+    }
+    if (complete && recordCount == first.bodyCount) {
+      latest = first;
+      found = true;
+    }
+  }
+  return found;
+}
+
+void Checkpoint::read(const std::string& stem,
+    const CheckpointHeader& latest, size_t firstId, size_t lastId,
+    std::vector<double>& records) {
+  std::vector<double> fileRecords;
+  for (uint64_t rank = 0; rank < latest.processCount; ++rank) {
+    const std::string fileName = Checkpoint::getFileName(stem,
+      latest.number % 2, rank);
+    std::ifstream file(fileName, std::ios::binary);
+    CheckpointHeader header = {};
+    file.read(reinterpret_cast<char*>(&header), sizeof header);
+    fileRecords.resize(header.recordCount * BODY_MIGRATION_DATA_SIZE);
+    file.read(reinterpret_cast<char*>(fileRecords.data()),
+      fileRecords.size() * sizeof(double));
+    if (!file) {
+      throw std::runtime_error("could not read checkpoint " + fileName);
+    }
+    // Bodies may have been anywhere, so every file is searched
+    for (size_t offset = 0; offset < fileRecords.size();
+        offset += BODY_MIGRATION_DATA_SIZE) {
+      const size_t id = static_cast<size_t>(fileRecords[offset +
+        MIGRATION_ID]);
+      if (id >= firstId && id < lastId) {
+        records.insert(records.end(), fileRecords.begin() + offset,
+          fileRecords.begin() + offset + BODY_MIGRATION_DATA_SIZE);
+      }
+    }
+  }
+}
@@ -0,0 +1,116 @@
+// Copyright 2025 Stockholm Syndrome. Universidad de Costa Rica. CC BY 4.0
+
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common.hpp"
+
+/// @brief First bytes of a checkpoint file, followed by the bodies of one
+/// process as MigrationData
+struct CheckpointHeader {
+  /// CHECKPOINT_MAGIC
+  char magic[CHECKPOINT_MAGIC_SIZE];
+  /// Number of bodies in the universe
+  uint64_t bodyCount;
+  /// Number of processes that wrote the checkpoint, one file each
+  uint64_t processCount;
+  /// Checkpoints taken before this one
+  uint64_t number;
+  /// Simulated time when the checkpoint was taken
+  double time;
+  /// Number of MigrationData records in this file
+  uint64_t recordCount;
+};
+
+/// @class Checkpoint
+/// @brief Writes the bodies of a process to checkpoint files in a background
+/// thread, and reads them back to restart a simulation
+/// @details Each process writes its own file, so the thread does not make
+/// MPI calls. Checkpoints alternate between two generations of files, so
+/// the last complete one survives if a process dies while writing. A file
+/// is written under a temporary name and renamed when complete.
+class Checkpoint {
+  DISABLE_COPY(Checkpoint);
+
+ private:
+  /// Writes the pending records, started by the first write()
+  std::thread writer;
+  /// Protects the members shared with the writer
+  std::mutex mutex;
+  /// Signals a new pending checkpoint, or that the last one was written
+  std::condition_variable changed;
+  /// Name of the file of the pending checkpoint
+  std::string fileName;
+  /// Header of the pending checkpoint
+  CheckpointHeader header = {};
+  /// Records of the pending checkpoint, swapped with the ones of the caller
+  std::vector<double> records;
+  /// True from write() until the writer is done with the records
+  bool pending = false;
+  /// True when the writer must finish
+  bool stopping = false;
+  /// Error of the last write, reported by the next call
+  std::string error;
+
+ public:
+  /// @brief Default constructor, the writer thread starts when needed
+  Checkpoint() = default;
+  /// @brief Wait for the pending checkpoint and stop the writer thread
+  ~Checkpoint();
+
+  /// @brief Get the name of the file a process writes a checkpoint to
+  /// @param stem Universe file name without its extension
+  /// @param generation Checkpoint number modulo 2
+  /// @param rank Rank of the process
+  static std::string getFileName(const std::string& stem, uint64_t generation,
+    uint64_t rank);
+
+  /// @brief Hand a checkpoint to the writer thread, which writes it while the
+  /// caller fills its buffer again. Waits for the previous one first
+  /// @param fileName Name of the file to write
+  /// @param header Header of the file, recordCount is set from records
+  /// @param records Bodies as MigrationData. Swapped with the buffer the
+  /// writer is done with, whose contents are undefined
+  /// @throw std::runtime_error if the previous checkpoint failed
+  void write(const std::string& fileName, const CheckpointHeader& header,
+    std::vector<double>& records);
+
+  /// @brief Wait until the pending checkpoint is written
+  /// @throw std::runtime_error if it failed
+  void wait();
+
+  /// @brief Find the newest checkpoint whose files are all complete
+  /// @param stem Universe file name without its extension
+  /// @param latest Header of its first file, if any
+  /// @return true if a complete checkpoint was found
+  static bool findLatest(const std::string& stem, CheckpointHeader& latest);
+
+  /// @brief Read the bodies of a checkpoint whose ids are in a range
+  /// @param stem Universe file name without its extension
+  /// @param latest Header returned by findLatest
+  /// @param firstId,lastId Range [firstId, lastId[ of ids to keep
+  /// @param records Vector where the MigrationData is added
+  static void read(const std::string& stem, const CheckpointHeader& latest,
+    size_t firstId, size_t lastId, std::vector<double>& records);
+
+ private:
+  /// @brief Body of the writer thread
+  void run();
+  /// @brief Write a file under a temporary name, then rename it
+  /// @return Empty string on success, the error otherwise
+  static std::string writeFile(const std::string& fileName,
+    const CheckpointHeader& header, const std::vector<double>& records);
+  /// @brief Read the header of a file
+  /// @return true if the file is a complete checkpoint file
+  static bool readHeader(const std::string& fileName,
+    CheckpointHeader& header);
+};
+
+#endif  // CHECKPOINT_HPP
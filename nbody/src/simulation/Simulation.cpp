@@ -4,8 +4,11 @@
 
 #include <cstdio>
 #include <cmath>
+#include <cstring>
 #include <iostream>
 #include <fstream>
+#include <omp.h>  // NOLINT[BUILD-LACK_INCLUDE_SCORE_ORDER]
+#include <random>
 #include <sstream>
 #include <stdexcept>
 #include <string>
@@ -38,6 +41,87 @@ const char* const usage_random_universe =
 "  min_vel      Minimum value the initial velocity can take at x, y, or z\n"
 "  max_vel      Maximum value the initial velocity can take at x, y, or z\n";
 
+// Usage message for the options accepted by both modes
+const char* const usage_options =
+"Options, appended after the arguments of either mode:\n\n"
+"  --forces=MODE  Acceleration method: direct (default), symmetric or\n"
+"                 barnes-hut\n"
+"  --theta=VALUE  Opening angle for barnes-hut (default 0.5)\n"
+"  --exchange=M   Sharing of bodies between processes: broadcast (default),\n"
+"                 ring, allgather or fused\n"
+"  --progress=P   Ring transfers advance when the master thread waits for\n"
+"                 them (wait, default) or it polls them while the other\n"
+"                 threads compute (thread)\n"
+"  --integrator=I Advance bodies with euler (default) or leapfrog\n"
+"  --statistics=S Distance statistics computed in closed form (closed,\n"
+"                 default) or enumerating every pair (pairs)\n"
+"  --precision=P  Direct accelerations in double (default) or mixed precision\n"
+"  --tile=L[,S]   Sweep direct forces in tiles of L local bodies against S\n"
+"                 source bodies (default 0, no tiling)\n"
+"  --time-bins=K  Split each state in 2^K sub-steps, advancing every body\n"
+"                 at the coarsest step its pull allows (default 0, off)\n"
+"  --eta=VALUE    Accuracy factor of the time bins (default 0.1)\n"
+"  --balance=F    Spread active bodies evenly again when a process holds\n"
+"                 over 1 + F times its share (default 0, never)\n"
+"  --compact=F    Take absorbed bodies out of the sweeps when they are over\n"
+"                 a fraction F of a process' bodies (default 0, never)\n"
+"  --morton=K     Sort bodies along a Morton curve and split it among\n"
+"                 processes at start and every K steps (default 0, never)\n"
+"  --checkpoint=K Save the bodies to checkpoint files every K steps, in a\n"
+"                 background thread (default 0, never)\n"
+"  --checkpoint-seconds=T\n"
+"                 Save a checkpoint when T seconds passed since the last\n"
+"                 one (default 0, never)\n"
+"  --trajectory=K Append the positions of bodies to a trajectory file per\n"
+"                 process every K steps, in a background thread (default\n"
+"                 0, never)\n"
+"  --trajectory-stride=S\n"
+"                 Only write bodies whose position in the universe file is\n"
+"                 a multiple of S to the trajectory (default 1, all)\n"
+"  --restart      Resume from the latest complete checkpoint of the\n"
+"                 universe file, with any number of processes\n"
+"  --seed=S       Seed of the random universe, which is the same for a\n"
+"                 seed whatever the number of threads and processes\n"
+"                 (default drawn from the system)\n"
+"  --convert=FILE Save the loaded universe to FILE in binary format and\n"
+"                 exit without simulating\n";
+
+// Parse the whole value of a numeric option with a std::sto* function,
+// reporting malformed or out of range values as bad arguments
+template <typename Parse>
+static auto parseNumber(const std::string& name, const std::string& value,
+    Parse parse) -> decltype(parse(value, nullptr)) {
+  try {
+    size_t parsedLength = 0;
+    const auto number = parse(value, &parsedLength);
+    if (parsedLength == value.size()) {
+      return number;
+    }
+  } catch (const std::logic_error&) {
+    // Raised as invalid_argument or out_of_range, reported below
+  }
+  throw std::invalid_argument("invalid value for --" + name + ": " + value);
+}
+
+static int parseInt(const std::string& name, const std::string& value) {
+  return parseNumber(name, value, [](const std::string& text, size_t* end) {
+    return std::stoi(text, end);
+  });
+}
+
+static double parseDouble(const std::string& name, const std::string& value) {
+  return parseNumber(name, value, [](const std::string& text, size_t* end) {
+    return std::stod(text, end);
+  });
+}
+
+static uint64_t parseUnsigned(const std::string& name,
+    const std::string& value) {
+  return parseNumber(name, value, [](const std::string& text, size_t* end) {
+    return std::stoull(text, end);
+  });
+}
+
 // Destructor cleans up MPI resources
 Simulation::~Simulation() {
   delete this->mpi;
@@ -50,8 +134,16 @@ int Simulation::run(int argc, char* argv[]) {
   if (this->startSimulation(argc, argv) != EXIT_SUCCESS) {
     return EXIT_FAILURE;
   }
+  // Only convert the universe file to binary if requested
+  if (!this->convertFile.empty()) {
+    this->saveBinaryState(this->convertFile);
+    return EXIT_SUCCESS;
+  }
   // Simulate states
   double simulatedTime = this->simulate();
+  // The last checkpoint is complete before the final state is written
+  this->checkpoint.wait();
+  this->trajectory.close();
   // Save in a file, the final state of the universe
   this->saveFinalState(simulatedTime);
   // Report results
@@ -64,20 +156,45 @@ int Simulation::startSimulation(int argc, char* argv[]) {
     // Initialize MPI communication
     this->mpi = new Mpi(argc, argv);
     // Load or create initial universe state
-    if (this->analyzeArguments(argc, argv) == UNIVERSE_FILE_MODE) {
+    const ExecutionMode mode = this->analyzeArguments(argc, argv);
+    if (this->restart) {
+      // Resume where the latest checkpoint left the bodies
+      this->loadCheckpoint();
+    } else if (mode == UNIVERSE_FILE_MODE) {
       // Load universe from file (distributed across processes)
       this->totalBodiesCount = this->universe.loadUniverse(this->universeFile,
         this->mpi->rank(), this->mpi->size());
     } else {
+      // Every process draws from the same seed, so it is shared
+      if (!this->seeded) {
+        std::random_device device;
+        this->seed = (uint64_t(device()) << 32) | device();
+        this->mpi->broadcast(this->seed, 0);
+      }
       // Create random universe (distributed across processes)
       this->universe.createUniverse(this->mpi->rank(), this->mpi->size(),
-        this->totalBodiesCount);
+        this->totalBodiesCount, this->seed);
+    }
+    this->totalActiveBodiesCount = this->totalBodiesCount;
+    if (this->restart) {
+      this->mpi->allReduce(this->universe.activeCount(),
+        this->totalActiveBodiesCount, MPI_SUM);
+    }
+    // Start with bodies close in space close in memory too
+    if (this->sortInterval > 0 &&
+        this->totalBodiesCount >= this->mpi->size()) {
+      this->universe.sortMorton(this->mpi);
+    }
+    // Every process appends the initial positions to its trajectory file
+    if (this->trajectoryInterval > 0 && this->convertFile.empty()) {
+      this->startTrajectory();
     }
   } catch (const std::invalid_argument& error) {
     // Handle argument errors
     std::cerr << "error: " << error.what() << std::endl;
     std::cout << usage_universe_file << std::endl;
     std::cout << usage_random_universe << std::endl;
+    std::cout << usage_options << std::endl;
     return EXIT_FAILURE;
   } catch (const std::runtime_error& error) {
     // Handle runtime errors
@@ -102,6 +219,14 @@ ExecutionMode Simulation::analyzeArguments(int argc, char* argv[]) {
     }
   }
 
+  // Separate options from the positional arguments of each mode
+  std::vector<char*> arguments = this->analyzeOptions(argc, argv);
+  argc = static_cast<int>(arguments.size());
+  argv = arguments.data();
+  if (argc < 4)  {
+    throw std::invalid_argument("insufficient arguments");
+  }
+
   // Parse time parameters from arguments
   try {
     this->deltaTime = std::stod(argv[DELTA_T]);
@@ -135,99 +260,798 @@ ExecutionMode Simulation::analyzeArguments(int argc, char* argv[]) {
   return UNIVERSE_FILE_MODE;
 }
 
+std::vector<char*> Simulation::analyzeOptions(int argc, char* argv[]) {
+  std::vector<char*> arguments;
+  for (int index = 0; index < argc; ++index) {
+    const std::string argument = argv[index];
+    // Positional arguments are kept in order
+    if (index == 0 || argument.rfind("--", 0) != 0) {
+      arguments.push_back(argv[index]);
+      continue;
+    }
+    const size_t equals = argument.find('=');
+    const std::string name = argument.substr(2, equals == std::string::npos ?
+      std::string::npos : equals - 2);
+    const std::string value = equals == std::string::npos ? "" :
+      argument.substr(equals + 1);
+    this->setOption(name, value);
+  }
+  return arguments;
+}
+
+void Simulation::setOption(const std::string& name,
+    const std::string& value) {
+  if (name == "forces") {
+    if (value == "direct") {
+      this->forceMode = FORCE_DIRECT;
+    } else if (value == "symmetric") {
+      this->forceMode = FORCE_SYMMETRIC;
+    } else if (value == "barnes-hut") {
+      this->forceMode = FORCE_BARNES_HUT;
+    } else {
+      throw std::invalid_argument("unknown force mode: " + value);
+    }
+  } else if (name == "exchange") {
+    if (value == "broadcast") {
+      this->exchangeMode = EXCHANGE_BROADCAST;
+    } else if (value == "ring") {
+      this->exchangeMode = EXCHANGE_RING;
+    } else if (value == "allgather") {
+      this->exchangeMode = EXCHANGE_ALLGATHER;
+    } else if (value == "fused") {
+      this->exchangeMode = EXCHANGE_FUSED;
+    } else {
+      throw std::invalid_argument("unknown exchange mode: " + value);
+    }
+  } else if (name == "precision") {
+    if (value == "double") {
+      this->precision = PRECISION_DOUBLE;
+    } else if (value == "mixed") {
+      this->precision = PRECISION_MIXED;
+    } else {
+      throw std::invalid_argument("unknown precision: " + value);
+    }
+    this->universe.setMixedPrecision(this->precision == PRECISION_MIXED);
+  } else if (name == "progress") {
+    if (value == "wait") {
+      this->progress = PROGRESS_WAIT;
+    } else if (value == "thread") {
+      this->progress = PROGRESS_THREAD;
+    } else {
+      throw std::invalid_argument("unknown progress mode: " + value);
+    }
+  } else if (name == "integrator") {
+    if (value == "euler") {
+      this->integrator = INTEGRATOR_EULER;
+    } else if (value == "leapfrog") {
+      this->integrator = INTEGRATOR_LEAPFROG;
+    } else {
+      throw std::invalid_argument("unknown integrator: " + value);
+    }
+  } else if (name == "statistics") {
+    if (value == "closed") {
+      this->statisticsMode = STATISTICS_CLOSED;
+    } else if (value == "pairs") {
+      this->statisticsMode = STATISTICS_PAIRS;
+    } else {
+      throw std::invalid_argument("unknown statistics mode: " + value);
+    }
+  } else if (name == "theta") {
+    this->theta = parseDouble(name, value);
+    if (this->theta < 0) {
+      throw std::invalid_argument("negative theta is not permitted");
+    }
+  } else if (name == "tile") {
+    // Either one size for both tiles, or local and source sizes
+    const size_t comma = value.find(',');
+    const int localTileSize = parseInt(name, value.substr(0, comma));
+    const int sourceTileSize = comma == std::string::npos ? localTileSize
+      : parseInt(name, value.substr(comma + 1));
+    if (localTileSize < 0 || sourceTileSize < 0) {
+      throw std::invalid_argument("negative tile size is not permitted");
+    }
+    this->universe.setTileSizes(localTileSize, sourceTileSize);
+  } else if (name == "balance") {
+    this->balanceThreshold = parseDouble(name, value);
+    if (this->balanceThreshold < 0) {
+      throw std::invalid_argument("negative balance threshold is not "
+        "permitted");
+    }
+  } else if (name == "checkpoint") {
+    this->checkpointInterval = parseInt(name, value);
+    if (this->checkpointInterval < 0) {
+      throw std::invalid_argument("negative checkpoint interval is not "
+        "permitted");
+    }
+  } else if (name == "checkpoint-seconds") {
+    this->checkpointSeconds = parseDouble(name, value);
+    if (this->checkpointSeconds < 0) {
+      throw std::invalid_argument("negative checkpoint seconds are not "
+        "permitted");
+    }
+  } else if (name == "trajectory") {
+    this->trajectoryInterval = parseInt(name, value);
+    if (this->trajectoryInterval < 0) {
+      throw std::invalid_argument("negative trajectory interval is not "
+        "permitted");
+    }
+  } else if (name == "trajectory-stride") {
+    const int stride = parseInt(name, value);
+    if (stride < 1) {
+      throw std::invalid_argument("trajectory stride must be positive");
+    }
+    this->trajectoryStride = stride;
+  } else if (name == "seed") {
+    if (value.empty() || value[0] == '-') {
+      throw std::invalid_argument("seed must be a non negative integer");
+    }
+    this->seed = parseUnsigned(name, value);
+    this->seeded = true;
+  } else if (name == "restart") {
+    this->restart = true;
+  } else if (name == "convert") {
+    if (value.empty()) {
+      throw std::invalid_argument("missing binary file to convert to");
+    }
+    this->convertFile = value;
+  } else if (name == "morton") {
+    this->sortInterval = parseInt(name, value);
+    if (this->sortInterval < 0) {
+      throw std::invalid_argument("negative sort interval is not permitted");
+    }
+  } else if (name == "compact") {
+    this->compactThreshold = parseDouble(name, value);
+    if (this->compactThreshold < 0 || this->compactThreshold >= 1) {
+      throw std::invalid_argument("compact threshold must be in [0, 1)");
+    }
+  } else if (name == "time-bins") {
+    this->maxTimeBin = parseInt(name, value);
+    // Sub-steps are counted in a size_t
+    if (this->maxTimeBin < 0 || this->maxTimeBin > 30) {
+      throw std::invalid_argument("time bins must be in [0, 30]");
+    }
+    this->universe.setTimeBins(this->maxTimeBin > 0);
+  } else if (name == "eta") {
+    this->timeBinEta = parseDouble(name, value);
+    if (this->timeBinEta <= 0) {
+      throw std::invalid_argument("eta must be positive");
+    }
+  } else {
+    throw std::invalid_argument("unknown option: --" + name);
+  }
+}
+
 double Simulation::simulate() {
-  // Main simulation loop
-  double currentTime = 0.0;
-  this->totalActiveBodiesCount = this->totalBodiesCount;
-  // Simulation loop until max time is reached or only one body remains
-  while (currentTime < this->maxTime && this->totalActiveBodiesCount > 1) {
-    this->stateCollisions();
-    this->stateAccelerations();
-    this->statePositions();
-    // Synchronize active body count across all processes
-    this->mpi->allReduce(this->universe.activeCount(),
-      this->totalActiveBodiesCount, MPI_SUM);
-    currentTime += this->deltaTime;  // Advance simulation time
-  }
-  return currentTime;
+  if (this->maxTimeBin > 0) {
+    return this->simulateTimeBins();
+  }
+  double simulatedTime = 0.0;
+  this->lastCheckpointTime = Mpi::wtime();
+  // One team of threads runs the whole loop, sharing the work of each state.
+  // MPI calls are made by the master thread while the others wait.
+  // Omitting default(none) given MPI operations are globals of the library
+  #pragma omp parallel num_threads(omp_get_max_threads()) \
+    shared(simulatedTime)
+  {
+    // Every thread keeps its own copy of the loop counters
+    double currentTime = this->startTime;
+    // Leapfrog keeps velocities half a step ahead of positions, so the first
+    // kick only covers half a step, unless restarted from a checkpoint
+    double kickTime = this->integrator == INTEGRATOR_LEAPFROG &&
+      currentTime == 0.0 ? this->deltaTime / 2 : this->deltaTime;
+    // Simulation loop until max time is reached or only one body remains
+    while (currentTime < this->maxTime && this->totalActiveBodiesCount > 1) {
+      if (this->exchangeMode == EXCHANGE_FUSED) {
+        this->stateCollisionsAndAccelerations();
+        this->stateCompaction();
+      } else {
+        this->stateCollisions();
+        this->stateCompaction();
+        this->stateAccelerations();
+      }
+      this->statePositions(kickTime);
+      kickTime = this->deltaTime;
+      // Synchronize active body count across all processes
+      #pragma omp master
+      {
+        this->mpi->allReduce(this->universe.activeCount(),
+          this->totalActiveBodiesCount, MPI_SUM);
+        this->stateSort();
+        this->stateBalance();
+        this->stateCheckpoint(currentTime + this->deltaTime);
+        this->stateTrajectory(currentTime + this->deltaTime);
+      }
+      #pragma omp barrier
+      currentTime += this->deltaTime;  // Advance simulation time
+    }
+    if (this->integrator == INTEGRATOR_LEAPFROG && currentTime > 0.0) {
+      // Bring velocities back to the time of the positions with the pull at
+      // the final positions
+      this->stateAccelerations();
+      this->universe.updateVelocities(this->deltaTime / 2);
+    }
+    #pragma omp master
+    simulatedTime = currentTime;
+  }
+  return simulatedTime;
+}
+
+double Simulation::simulateTimeBins() {
+  double simulatedTime = 0.0;
+  this->lastCheckpointTime = Mpi::wtime();
+  const size_t subStepCount = size_t(1) << this->maxTimeBin;
+  const double subStepTime = this->deltaTime / subStepCount;
+  ExchangeBuffers<double>& buffers = this->buffers;
+  // See simulate
+  #pragma omp parallel num_threads(omp_get_max_threads()) \
+    shared(simulatedTime, subStepCount, subStepTime, buffers)
+  {
+    double currentTime = this->startTime;
+    while (currentTime < this->maxTime && this->totalActiveBodiesCount > 1) {
+      if (this->exchangeMode == EXCHANGE_FUSED) {
+        this->stateCollisionsAndAccelerations();
+        this->stateCompaction();
+      } else {
+        this->stateCollisions();
+        this->stateCompaction();
+        this->stateAccelerations();
+      }
+      // The pull at the start of this block also ends the steps of the last
+      this->universe.startTimeBins(currentTime > 0.0, this->deltaTime,
+        this->maxTimeBin, this->timeBinEta);
+      // Others keep a copy of these bodies and drift it themselves
+      #pragma omp master
+      {
+        buffers.myBodies.clear();
+        this->universe.serializeCollisionData(buffers.myBodies);
+        this->mpi->allGatherv(buffers.myBodies, buffers.allBodies,
+          buffers.offsets);
+        this->mpi->allReduce(this->universe.getDeepestTimeBin(),
+          this->deepestTimeBin, MPI_MAX);
+      }
+      #pragma omp barrier
+      this->universe.setMirror(buffers.allBodies, buffers.offsets,
+        this->mpi->rank());
+      size_t subStep = 0;
+      while (subStep < subStepCount) {
+        // Sub-steps where no bin ends a step are drifted over at once
+        const size_t stride = subStepCount >> this->deepestTimeBin;
+        const size_t nextSubStep = subStep - subStep % stride + stride;
+        this->universe.driftTimeBins((nextSubStep - subStep) * subStepTime);
+        subStep = nextSubStep;
+        if (subStep == subStepCount) {
+          break;  // The next block starts updating all accelerations
+        }
+        #pragma omp single
+        buffers.myBodies.clear();
+        this->universe.advanceTimeBins(subStep, this->deltaTime,
+          this->maxTimeBin, this->timeBinEta, buffers.myBodies);
+        #pragma omp master
+        this->mpi->allGatherv(buffers.myBodies, buffers.allBodies,
+          buffers.offsets);
+        #pragma omp barrier
+        this->universe.applyMirrorChanges(buffers.allBodies, buffers.offsets,
+          this->mpi->rank());
+        #pragma omp master
+        this->mpi->allReduce(this->universe.getDeepestTimeBin(),
+          this->deepestTimeBin, MPI_MAX);
+        #pragma omp barrier
+      }
+      #pragma omp master
+      {
+        this->mpi->allReduce(this->universe.activeCount(),
+          this->totalActiveBodiesCount, MPI_SUM);
+        this->stateSort();
+        this->stateBalance();
+        this->stateCheckpoint(currentTime + this->deltaTime);
+        this->stateTrajectory(currentTime + this->deltaTime);
+      }
+      #pragma omp barrier
+      currentTime += this->deltaTime;
+    }
+    if (currentTime > 0.0) {
+      // Close the last steps with the pull at the final positions
+      this->stateAccelerations();
+      this->universe.finishTimeBins(this->deltaTime);
+    }
+    #pragma omp master
+    simulatedTime = currentTime;
+  }
+  return simulatedTime;
+}
+
+template <>
+Simulation::ExchangeBuffers<double>& Simulation::getBuffers<double>() {
+  return this->buffers;
+}
+
+template <>
+Simulation::ExchangeBuffers<float>& Simulation::getBuffers<float>() {
+  return this->floatBuffers;
 }
 
 // Handles collision detection and resolution
 void Simulation::stateCollisions() {
   // check local collisions
   this->universe.checkCollisions();
-  std::vector<double> serializedBodies;
+  ExchangeBuffers<double>& buffers = this->buffers;
+  if (this->exchangeMode != EXCHANGE_BROADCAST) {
+    // Every process checks against the state others had after their local
+    // collisions, instead of waiting for earlier ranks
+    #pragma omp single
+    {
+      buffers.myBodies.clear();
+      this->universe.serializeCollisionData(buffers.myBodies);
+    }
+    const auto check = [this](std::vector<double>& otherBodies,
+        int otherRank) {
+      this->universe.checkCollisions(otherBodies, this->mpi->rank(),
+        otherRank);
+    };
+    if (this->exchangeMode == EXCHANGE_RING) {
+      // Local merges change the bodies sent, so nothing overlaps step 1
+      this->ringExchange(buffers.myBodies, COLLISION_TAG, check, [] {});
+    } else {
+      this->gatherExchange(buffers.myBodies, check);
+    }
+    return;
+  }
   // broadcast cycle to check colllsions between all processes
   for (int rank  = 0; rank < this->mpi->size(); ++rank) {
+    #pragma omp master
+    {
+      if (rank == mpi->rank()) {
+        buffers.otherBodies.clear();
+        this->universe.serializeCollisionData(buffers.otherBodies);
+      }
+      mpi->broadcast(buffers.otherBodies, rank);
+    }
+    #pragma omp barrier
     if (rank != mpi->rank()) {
-      mpi->broadcast(serializedBodies, rank);
-      this->universe.checkCollisions(serializedBodies, this->mpi->rank(), rank);
-    } else {
-      serializedBodies.clear();
-      serializedBodies.reserve(this->universe.activeCount() *
-        BODY_COLLISION_DATA_SIZE);
-      this->universe.serializeCollisionData(serializedBodies);
-      mpi->broadcast(serializedBodies, rank);
+      this->universe.checkCollisions(buffers.otherBodies, this->mpi->rank(),
+        rank);
     }
   }
 }
 
 void Simulation::stateAccelerations() {
-  // check local accelerations
-  this->universe.updateAccelerations();
-  std::vector<double> serializedBodies;
+  if (this->forceMode == FORCE_BARNES_HUT) {
+    this->stateAccelerationsBarnesHut();
+    return;
+  }
+  if (this->precision == PRECISION_MIXED) {
+    this->exchangeAccelerations<float>();
+  } else {
+    this->exchangeAccelerations<double>();
+  }
+}
+
+template <typename Type>
+void Simulation::exchangeAccelerations() {
+  ExchangeBuffers<Type>& buffers = this->getBuffers<Type>();
+  // Local pulls only write accelerations, so the data sent is ready before
+  const bool symmetric = this->forceMode == FORCE_SYMMETRIC;
+  const auto local = [this, symmetric]() {
+    if (this->progress == PROGRESS_THREAD) {
+      this->universe.updateAccelerations(symmetric,
+        [this]() { this->progressTransfers(); });
+    } else {
+      this->universe.updateAccelerations(symmetric);
+    }
+  };
+  if (this->exchangeMode != EXCHANGE_BROADCAST) {
+    #pragma omp single
+    {
+      buffers.myBodies.clear();
+      this->universe.serializeAccelerationData(buffers.myBodies);
+    }
+    const auto update = [this](std::vector<Type>& otherBodies, int) {
+      if (this->progress == PROGRESS_THREAD) {
+        this->universe.updateAccelerations(otherBodies,
+          [this]() { this->progressTransfers(); });
+      } else {
+        this->universe.updateAccelerations(otherBodies);
+      }
+    };
+    if (this->exchangeMode == EXCHANGE_RING) {
+      this->ringExchange(buffers.myBodies, ACCELERATION_TAG, update, local);
+    } else {
+      local();
+      this->gatherExchange(buffers.myBodies, update);
+    }
+    return;
+  }
+  local();
   // broadcast cycle to update acceleration between all processes
   for (int rank  = 0; rank < this->mpi->size(); ++rank) {
+    #pragma omp master
+    {
+      if (rank == mpi->rank()) {
+        buffers.otherBodies.clear();
+        this->universe.serializeAccelerationData(buffers.otherBodies);
+      }
+      mpi->broadcast(buffers.otherBodies, rank);
+    }
+    #pragma omp barrier
     if (rank != mpi->rank()) {
-      mpi->broadcast(serializedBodies, rank);
-      this->universe.updateAccelerations(serializedBodies);
+      this->universe.updateAccelerations(buffers.otherBodies);
+    }
+  }
+}
+
+void Simulation::stateAccelerationsBarnesHut() {
+  ExchangeBuffers<double>& buffers = this->buffers;
+  #pragma omp master
+  {
+    buffers.myBodies.clear();
+    this->universe.serializeAccelerationData(buffers.myBodies);
+    // Every process needs all bodies to build the octree
+    this->mpi->allGatherv(buffers.myBodies, buffers.allBodies,
+      buffers.offsets);
+    // Own bodies are added by the universe itself
+    const int rank = this->mpi->rank();
+    buffers.otherBodies.assign(buffers.allBodies.begin(),
+      buffers.allBodies.begin() + buffers.offsets[rank]);
+    buffers.otherBodies.insert(buffers.otherBodies.end(),
+      buffers.allBodies.begin() + buffers.offsets[rank + 1],
+      buffers.allBodies.end());
+  }
+  #pragma omp barrier
+  this->universe.updateAccelerationsBarnesHut(buffers.otherBodies,
+    this->theta);
+}
+
+template <typename Type, typename Process, typename Local>
+void Simulation::ringExchange(std::vector<Type>& myBodies, const int tag,
+    const Process& process, const Local& local) {
+  const int rank = this->mpi->rank();
+  const int size = this->mpi->size();
+  if (size == 1) {
+    local();
+    return;
+  }
+  const int next = (rank + 1) % size;
+  const int previous = (rank + size - 1) % size;
+  ExchangeBuffers<Type>& buffers = this->getBuffers<Type>();
+  std::vector<Type>& heldBodies = buffers.otherBodies;
+  std::vector<Type>& incomingBodies = buffers.incomingBodies;
+  // Only used by the master thread
+  std::vector<int> counts;
+  // Block sizes are known in advance, so receives can be posted right away
+  #pragma omp master
+  {
+    this->mpi->allGather(static_cast<int>(myBodies.size()), counts);
+    heldBodies.swap(myBodies);
+  }
+  #pragma omp barrier
+  // After step s, a process holds the block of the process s ranks before it
+  for (int step = 1; step < size; ++step) {
+    // The team processes the held block while the master sends it on
+    #pragma omp master
+    {
+      incomingBodies.resize(counts[(rank + size - step) % size]);
+      this->pendingRequests[0] = this->mpi->receiveAsync(
+        incomingBodies.data(), static_cast<int>(incomingBodies.size()),
+        previous, tag);
+      this->pendingRequests[1] = this->mpi->sendAsync(heldBodies.data(),
+        static_cast<int>(heldBodies.size()), next, tag);
+      this->pendingCount = 2;
+    }
+    // The own block is sent first, while the team does the local work
+    if (step > 1) {
+      process(heldBodies, (rank + size - step + 1) % size);
     } else {
-      serializedBodies.clear();
-      serializedBodies.reserve(this->universe.activeCount() *
-        BODY_ACCELERATION_DATA_SIZE);
-      this->universe.serializeAccelerationData(serializedBodies);
-      mpi->broadcast(serializedBodies, rank);
+      local();
+    }
+    #pragma omp master
+    {
+      this->mpi->waitAll(this->pendingRequests, this->pendingCount);
+      this->pendingCount = 0;
+      heldBodies.swap(incomingBodies);
+    }
+    #pragma omp barrier
+  }
+  process(heldBodies, next);
+}
+
+void Simulation::progressTransfers() {
+  // Libraries often only move data inside MPI calls, so keep calling
+  while (!this->mpi->testAll(this->pendingRequests, this->pendingCount)) {
+  }
+}
+
+template <typename Type, typename Process>
+void Simulation::gatherExchange(const std::vector<Type>& myBodies,
+    const Process& process) {
+  ExchangeBuffers<Type>& buffers = this->getBuffers<Type>();
+  #pragma omp master
+  this->mpi->allGatherv(myBodies, buffers.allBodies, buffers.offsets);
+  #pragma omp barrier
+  for (int rank = 0; rank < this->mpi->size(); ++rank) {
+    if (rank != this->mpi->rank()) {
+      #pragma omp single
+      buffers.otherBodies.assign(buffers.allBodies.begin() +
+        buffers.offsets[rank], buffers.allBodies.begin() +
+        buffers.offsets[rank + 1]);
+      process(buffers.otherBodies, rank);
+    }
+  }
+}
+
+void Simulation::stateCollisionsAndAccelerations() {
+  this->universe.checkCollisions();
+  ExchangeBuffers<double>& buffers = this->buffers;
+  const int myRank = this->mpi->rank();
+  // Collisions do not move bodies, so this data also serves for forces
+  #pragma omp master
+  {
+    buffers.myBodies.clear();
+    this->universe.serializeCollisionData(buffers.myBodies);
+    this->mpi->allGatherv(buffers.myBodies, buffers.allBodies,
+      buffers.offsets);
+  }
+  #pragma omp barrier
+  for (int rank = 0; rank < this->mpi->size(); ++rank) {
+    if (rank != myRank) {
+      #pragma omp single
+      buffers.otherBodies.assign(buffers.allBodies.begin() +
+        buffers.offsets[rank], buffers.allBodies.begin() +
+        buffers.offsets[rank + 1]);
+      this->universe.checkCollisions(buffers.otherBodies, myRank, rank);
+    }
+  }
+
+  // Only the masses changed by collisions are shared again
+  #pragma omp master
+  {
+    this->myChanges.clear();
+    this->universe.serializeMassChanges(buffers.myBodies, this->myChanges);
+    this->mpi->allGatherv(this->myChanges, this->allChanges,
+      this->changeOffsets);
+  }
+  #pragma omp barrier
+
+  if (this->forceMode == FORCE_BARNES_HUT) {
+    // Barnes-Hut puts the bodies of every process in the same octree
+    #pragma omp single
+    {
+      this->remoteBodies.clear();
+      for (int rank = 0; rank < this->mpi->size(); ++rank) {
+        if (rank != myRank) {
+          this->applyRemoteMassChanges(rank);
+        }
+      }
+    }
+    this->universe.updateAccelerationsBarnesHut(this->remoteBodies,
+      this->theta);
+    return;
+  }
+  this->universe.updateAccelerations(this->forceMode == FORCE_SYMMETRIC);
+  for (int rank = 0; rank < this->mpi->size(); ++rank) {
+    if (rank != myRank) {
+      #pragma omp single
+      {
+        this->remoteBodies.clear();
+        this->applyRemoteMassChanges(rank);
+      }
+      this->universe.updateAccelerations(this->remoteBodies);
+    }
+  }
+}
+
+void Simulation::applyRemoteMassChanges(int rank) {
+  ExchangeBuffers<double>& buffers = this->buffers;
+  buffers.otherBodies.assign(buffers.allBodies.begin() +
+    buffers.offsets[rank], buffers.allBodies.begin() +
+    buffers.offsets[rank + 1]);
+  Simulation::applyMassChanges(buffers.otherBodies, this->allChanges.data() +
+    this->changeOffsets[rank], (this->changeOffsets[rank + 1] -
+    this->changeOffsets[rank]) / BODY_MASS_CHANGE_SIZE, this->remoteBodies);
+}
+
+void Simulation::applyMassChanges(std::vector<double>& collisionBodies,
+    const double* changes, size_t changeCount,
+    std::vector<double>& accelerationBodies) {
+  for (size_t change = 0; change < changeCount; ++change) {
+    const size_t body = static_cast<size_t>(
+      changes[change * BODY_MASS_CHANGE_SIZE]);
+    collisionBodies[body * BODY_COLLISION_DATA_SIZE + COLLISION_MASS] =
+      changes[change * BODY_MASS_CHANGE_SIZE + 1];
+  }
+  for (size_t offset = 0; offset < collisionBodies.size();
+      offset += BODY_COLLISION_DATA_SIZE) {
+    // Bodies deactivated by collisions no longer pull on others
+    if (collisionBodies[offset + COLLISION_MASS] > 0.0) {
+      accelerationBodies.push_back(collisionBodies[offset + COLLISION_MASS]);
+      accelerationBodies.push_back(
+        collisionBodies[offset + COLLISION_POSITION_X]);
+      accelerationBodies.push_back(
+        collisionBodies[offset + COLLISION_POSITION_Y]);
+      accelerationBodies.push_back(
+        collisionBodies[offset + COLLISION_POSITION_Z]);
     }
   }
 }
 
 // Updates body positions based on velocities
-void Simulation::statePositions() {
+void Simulation::statePositions(double kickTime) {
   // Update velocities based on current accelerations
-  this->universe.updateVelocitiesAndPositions(this->deltaTime);
+  this->universe.updateVelocitiesAndPositions(this->deltaTime, kickTime);
 }
 
-void Simulation::saveFinalState(double simulatedTime) {
-  // Save the final state of the universe
-  for (int rank = 0; rank < this->mpi->size(); ++rank) {
-    // If it is my turn to report
-    if (rank == this->mpi->rank()) {
-      // Call universe's saveBodiesFile to write the final states of the bodies
-      // in the report file
-      this->universe.saveBodiesFile(this->universeFile, simulatedTime
-        , this->mpi->rank(), this->totalBodiesCount);
+void Simulation::stateBalance() {
+  // Every process must keep at least one body
+  if (this->balanceThreshold <= 0.0 ||
+      this->totalActiveBodiesCount < this->mpi->size()) {
+    return;
+  }
+  // Sweeps go over every stored body, active or not
+  int largestCount = 0;
+  this->mpi->allReduce(static_cast<int>(this->universe.size()), largestCount,
+    MPI_MAX);
+  // Shares differ by one body when the count is not a multiple
+  const double evenCount = std::ceil(static_cast<double>(
+    this->totalActiveBodiesCount) / this->mpi->size());
+  if (largestCount > (1.0 + this->balanceThreshold) * evenCount) {
+    this->universe.rebalance(this->mpi);
+  }
+}
+
+void Simulation::stateSort() {
+  if (this->sortInterval == 0 || ++this->stepsSinceSort < this->sortInterval
+      || this->totalActiveBodiesCount < this->mpi->size()) {
+    return;
+  }
+  this->universe.sortMorton(this->mpi);
+  this->stepsSinceSort = 0;
+}
+
+void Simulation::stateCheckpoint(double currentTime) {
+  bool due = this->checkpointInterval > 0 &&
+    ++this->stepsSinceCheckpoint >= this->checkpointInterval;
+  if (this->checkpointSeconds > 0.0) {
+    // Clocks differ among processes, so the first one decides for all
+    int late = Mpi::wtime() - this->lastCheckpointTime >=
+      this->checkpointSeconds;
+    this->mpi->broadcast(late, 0);
+    due = due || late;
+  }
+  if (!due) {
+    return;
+  }
+  this->checkpointRecords.clear();
+  this->universe.serializeCheckpoint(this->checkpointRecords);
+  CheckpointHeader header = {};
+  std::memcpy(header.magic, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_SIZE);
+  header.bodyCount = this->totalBodiesCount;
+  header.processCount = this->mpi->size();
+  header.number = this->checkpointCount;
+  header.time = currentTime;
+  // The writer takes the records and hands back the buffer it wrote last
+  this->checkpoint.write(Checkpoint::getFileName(Universe::getFileStem(
+    this->universeFile), this->checkpointCount % 2, this->mpi->rank()),
+    header, this->checkpointRecords);
+  ++this->checkpointCount;
+  this->stepsSinceCheckpoint = 0;
+  this->lastCheckpointTime = Mpi::wtime();
+}
+
+void Simulation::startTrajectory() {
+  const std::string stem = Universe::getFileStem(this->universeFile);
+  bool resumed = false;
+  if (this->restart) {
+    // Drop the frames from the checkpoint on, which are written again. The
+    // files of processes beyond this run's are cut but not appended to
+    for (int rank = this->mpi->rank(); TrajectoryWriter::truncate(
+        TrajectoryWriter::getFileName(stem, rank), this->totalBodiesCount,
+        this->trajectoryStride, this->startTime); rank += this->mpi->size()) {
+      resumed = resumed || rank == this->mpi->rank();
     }
-    // Ensure process finishes before moving on
-    this->mpi->barrier();
+  }
+  this->trajectory.open(TrajectoryWriter::getFileName(stem,
+    this->mpi->rank()), this->totalBodiesCount, this->trajectoryStride,
+    resumed);
+  // Keep the frames every trajectoryInterval steps from time 0
+  const int64_t steps = std::llround(this->startTime / this->deltaTime);
+  this->stepsSinceTrajectory = static_cast<int>(steps %
+    this->trajectoryInterval);
+  if (this->stepsSinceTrajectory == 0) {
+    this->writeTrajectoryFrame(this->startTime);
   }
 }
 
+void Simulation::stateTrajectory(double currentTime) {
+  if (this->trajectoryInterval == 0 ||
+      ++this->stepsSinceTrajectory < this->trajectoryInterval) {
+    return;
+  }
+  this->writeTrajectoryFrame(currentTime);
+  this->stepsSinceTrajectory = 0;
+}
+
+void Simulation::writeTrajectoryFrame(double currentTime) {
+  // The writer quantizes the positions, so this only copies them
+  TrajectoryFrame frame;
+  frame.time = currentTime;
+  this->universe.serializeTrajectory(this->trajectoryStride, frame.ids,
+    frame.positions);
+  this->trajectory.push(frame);
+}
+
+void Simulation::stateCompaction() {
+  if (this->compactThreshold > 0.0) {
+    #pragma omp single
+    this->universe.compact(this->compactThreshold);
+  }
+}
+
+void Simulation::saveFinalState(double simulatedTime) {
+  // Bodies are saved in the order of the universe file
+  this->universe.restoreHomeOrder(this->mpi, this->totalBodiesCount);
+  // Every process formats its bodies, then all write them at once
+  std::string text;
+  this->universe.formatBodiesFile(text, this->mpi->rank(),
+    this->totalBodiesCount);
+  this->mpi->writeOrdered(Universe::getStateFileName(this->universeFile,
+    simulatedTime), text.data(), text.size());
+}
+
+void Simulation::saveBinaryState(const std::string& fileName) {
+  this->universe.restoreHomeOrder(this->mpi, this->totalBodiesCount);
+  std::string data;
+  this->universe.formatBinaryFile(data, this->mpi->rank(),
+    this->totalBodiesCount);
+  this->mpi->writeOrdered(fileName, data.data(), data.size());
+}
+
+void Simulation::loadCheckpoint() {
+  const std::string stem = Universe::getFileStem(this->universeFile);
+  CheckpointHeader latest = {};
+  if (!Checkpoint::findLatest(stem, latest)) {
+    throw std::runtime_error("no complete checkpoint to restart from");
+  }
+  if (latest.bodyCount < static_cast<uint64_t>(this->mpi->size())) {
+    throw std::runtime_error("insufficient bodies in universe");
+  }
+  this->totalBodiesCount = static_cast<int>(latest.bodyCount);
+  // Bodies are split as if loaded from the universe file, whatever the
+  // number of processes that wrote the checkpoint
+  std::vector<double> records;
+  Checkpoint::read(stem, latest, Util::calculateStart(this->mpi->rank(),
+    this->totalBodiesCount, this->mpi->size()), Util::calculateFinish(
+    this->mpi->rank(), this->totalBodiesCount, this->mpi->size()), records);
+  this->universe.loadCheckpoint(records);
+  this->startTime = latest.time;
+  this->checkpointCount = latest.number + 1;
+}
+
 // Generates and displays final simulation statistics
 void Simulation::reportResults(const int totalActiveBodiesCount) {
-  // Gather distance and velocity data
-  const std::vector<RealVector> distances =
-      this->universe.getMyDistances(this->mpi);
-  const std::vector<RealVector> velocities = this->universe.getMyVelocities();
-  // Calculate distributed statistics across all processes
-  RealVector distanceMean = Statistics::realVectorMeanDistributed(this->mpi,
-      distances, totalActiveBodiesCount);
-  RealVector distanceStdev = Statistics::realVectorStDevDistributed(
-    this->mpi, distances, distanceMean, totalActiveBodiesCount);
-
-  RealVector velocityMean = Statistics::realVectorMeanDistributed(this->mpi,
-      velocities, totalActiveBodiesCount);
-  RealVector velocityStdev = Statistics::realVectorStDevDistributed(
-    this->mpi, velocities, velocityMean, totalActiveBodiesCount);
+  // Accumulate distance and velocity data, one vector at a time
+  Statistics::Moments distances;
+  if (this->statisticsMode == STATISTICS_PAIRS) {
+    // Enumerate every pair, to validate the closed form
+    distances = Statistics::momentsDistributed(this->mpi,
+      this->universe.getMyDistances(this->mpi));
+  } else {
+    Statistics::Moments positions;
+    RealVector rankedSum;
+    this->universe.getMyPositions(positions, rankedSum);
+    distances = Statistics::pairwiseMomentsDistributed(this->mpi, positions,
+      rankedSum);
+  }
+  const Statistics::Moments velocities = Statistics::momentsDistributed(
+    this->mpi, this->universe.getMyVelocities());
+  // Calculate statistics across all processes
+  RealVector distanceMean = Statistics::realVectorMean(distances,
+    totalActiveBodiesCount);
+  RealVector distanceStdev = Statistics::realVectorStDev(distances,
+    distanceMean, totalActiveBodiesCount);
+
+  RealVector velocityMean = Statistics::realVectorMean(velocities,
+    totalActiveBodiesCount);
+  RealVector velocityStdev = Statistics::realVectorStDev(velocities,
+    velocityMean, totalActiveBodiesCount);
   // Only first process reports results
   if (this->mpi->rank() != 0) {
     return;
@@ -3,10 +3,14 @@
 #ifndef SIMULATION_HPP
 #define SIMULATION_HPP
 
+#include <mpi.h>
+
 #include <string>
 #include <vector>
 
 #include "Body.hpp"
+#include "Checkpoint.hpp"
+#include "TrajectoryWriter.hpp"
 #include "common.hpp"
 #include "RealVector.hpp"
 #include "Universe.hpp"
@@ -31,14 +35,115 @@ class Simulation {
   int totalBodiesCount = 0;
   /// total active bodies in the simulation, currently.
   int totalActiveBodiesCount = 0;
+  /// method used to compute accelerations.
+  ForceMode forceMode = FORCE_DIRECT;
+  /// way processes share their bodies in each state.
+  ExchangeMode exchangeMode = EXCHANGE_BROADCAST;
+  /// precision of direct accelerations and the data sent for them.
+  Precision precision = PRECISION_DOUBLE;
+  /// how the master thread progresses the transfers of the ring exchange.
+  Progress progress = PROGRESS_WAIT;
+  /// method used to advance velocities and positions.
+  Integrator integrator = INTEGRATOR_EULER;
+  /// how the statistics of the distances between bodies are computed.
+  StatisticsMode statisticsMode = STATISTICS_CLOSED;
+  /// opening angle for Barnes-Hut approximation.
+  double theta = DEFAULT_THETA;
+  /// deepest time bin, each state is split in 2^maxTimeBin sub-steps. 0
+  /// advances all bodies together.
+  int maxTimeBin = 0;
+  /// accuracy factor for choosing the time bin of each body.
+  double timeBinEta = DEFAULT_TIME_BIN_ETA;
+  /// bodies are spread again when a process holds this fraction more than
+  /// an even share of the active bodies. 0 never spreads them.
+  double balanceThreshold = 0.0;
+  /// inactive bodies are taken out of the arrays of a process when they are
+  /// more than this fraction of its bodies. 0 never takes them out.
+  double compactThreshold = 0.0;
+  /// bodies are sorted along a Morton curve before the simulation and then
+  /// every this many steps. 0 never sorts them.
+  int sortInterval = 0;
+  /// steps simulated since bodies were last sorted.
+  int stepsSinceSort = 0;
+  /// a checkpoint is taken every this many steps. 0 never takes them.
+  int checkpointInterval = 0;
+  /// a checkpoint is taken when this many seconds passed since the last.
+  /// 0 never takes them.
+  double checkpointSeconds = 0.0;
+  /// true to resume from the latest checkpoint of the universe file.
+  bool restart = false;
+  /// simulated time the simulation starts from, not 0 when restarted.
+  double startTime = 0.0;
+  /// checkpoints taken, including the ones before a restart.
+  uint64_t checkpointCount = 0;
+  /// steps simulated since the last checkpoint.
+  int stepsSinceCheckpoint = 0;
+  /// wall time of the last checkpoint, or of the start.
+  double lastCheckpointTime = 0.0;
+  /// writes checkpoints in the background.
+  Checkpoint checkpoint;
+  /// bodies of the next checkpoint, while the last one is written.
+  std::vector<double> checkpointRecords;
+  /// positions are appended to the trajectory files every this many steps.
+  /// 0 never writes them.
+  int trajectoryInterval = 0;
+  /// only bodies whose id is a multiple of this are in the trajectory.
+  size_t trajectoryStride = 1;
+  /// steps simulated since the last trajectory frame.
+  int stepsSinceTrajectory = 0;
+  /// writes trajectory frames in the background.
+  TrajectoryWriter trajectory;
+
+  /// seed of the random universe, drawn by the first process if not given.
+  uint64_t seed = 0;
+  /// true if the seed was given as an option.
+  bool seeded = false;
 
   /// Container for the bodies in the simulation.
   Universe universe;
   /// File containing the universe data.
   std::string universeFile = "";
+  /// Binary universe file the loaded universe is converted to, instead of
+  /// simulating it. Empty to simulate.
+  std::string convertFile = "";
   /// Distributed MPI object for parallel processing.
   Mpi* mpi = nullptr;
 
+  /// @brief Bodies exchanged between processes. The whole team of threads
+  /// works on them, so they are shared members instead of local variables
+  /// @tparam Type Precision of the data sent, double or float
+  template <typename Type>
+  struct ExchangeBuffers {
+    /// Serialized bodies of this process
+    std::vector<Type> myBodies;
+    /// Block of another process being processed
+    std::vector<Type> otherBodies;
+    /// Block being received from the previous process of the ring
+    std::vector<Type> incomingBodies;
+    /// Blocks of all processes, gathered
+    std::vector<Type> allBodies;
+    /// Start of the block of each process in allBodies, plus the end
+    std::vector<int> offsets;
+  };
+  /// Buffers for bodies sent in double precision.
+  ExchangeBuffers<double> buffers;
+  /// Buffers for bodies sent in single precision.
+  ExchangeBuffers<float> floatBuffers;
+  /// Mass changes of this process, see Universe::serializeMassChanges.
+  std::vector<double> myChanges;
+  /// Mass changes of all processes, gathered.
+  std::vector<double> allChanges;
+  /// Start of the mass changes of each process, plus the end.
+  std::vector<int> changeOffsets;
+  /// Acceleration data of other processes after their mass changes.
+  std::vector<double> remoteBodies;
+  /// Deepest time bin among all processes, see simulateTimeBins.
+  int deepestTimeBin = 0;
+  /// Transfers of the ring exchange in flight, used by the master thread.
+  MPI_Request pendingRequests[2];
+  /// Number of requests in pendingRequests.
+  int pendingCount = 0;
+
  public:
   /// @brief Constructor for the Simulation class.
   Simulation() = default;
@@ -60,9 +165,25 @@ class Simulation {
   /// @see run for params
   /// @return The execution mode determined after analyzing the arguments
   ExecutionMode analyzeArguments(int argc, char* argv[]);
-  /// @brief Carries out main simulation loop
+  /// @brief Removes --name=value options from the arguments and applies them
+  /// @see run for params
+  /// @return The remaining positional arguments, including program name
+  std::vector<char*> analyzeOptions(int argc, char* argv[]);
+  /// @brief Applies a single option
+  /// @param name Name of the option, without leading dashes
+  /// @param value Text after the equals sign, empty if none
+  void setOption(const std::string& name, const std::string& value);
+  /// @brief Carries out main simulation loop. A single team of threads runs
+  /// the whole loop and the states below: they share the work on bodies, and
+  /// the master thread makes the MPI calls
   /// @return The total simulated time
   double simulate();
+  /// @brief Carries out the simulation loop with block timesteps: each state
+  /// is split in sub-steps and bodies only update accelerations and
+  /// velocities at the end of the step of their time bin. Collisions are
+  /// checked at the start of each state, when all bins are synchronized
+  /// @return The total simulated time
+  double simulateTimeBins();
 
  private:  // STATES FOR SIMULATE
   /// @brief State of the simulation in wich all processes
@@ -71,14 +192,105 @@ class Simulation {
   /// @brief State of the simulation in wich all processes
   // update the acceleration sum of each body from other broadcasted data.
   void stateAccelerations();
+  /// @brief State of the simulation in wich all processes share their
+  // bodies once to check collisions, then share only the masses changed by
+  // collisions and update accelerations from the same data.
+  void stateCollisionsAndAccelerations();
+  /// @brief Adds the pull of the local bodies and shares the acceleration
+  /// data of every process with the others, according to the exchange
+  /// mode, adding the pull of their bodies
+  /// @tparam Type Precision of the data sent, double or float
+  template <typename Type>
+  void exchangeAccelerations();
+  /// @brief State of the simulation in wich all processes gather every
+  // other process' bodies and approximate accelerations with an octree.
+  void stateAccelerationsBarnesHut();
+  /// @brief State of the simulation in wich all processes spread the active
+  // bodies evenly again if some process holds too many bodies, see
+  // balanceThreshold. Called by the master thread
+  void stateBalance();
+  /// @brief State of the simulation in wich all processes sort the active
+  // bodies along a Morton curve and split it among them, every sortInterval
+  // steps. Called by the master thread
+  void stateSort();
+  /// @brief State of the simulation in wich each process takes the bodies
+  // absorbed by collisions out of its arrays, see compactThreshold
+  void stateCompaction();
+  /// @brief State of the simulation in wich every process hands its bodies
+  // to the checkpoint writer, every checkpointInterval steps or
+  // checkpointSeconds. Called by the master thread
+  /// @param currentTime Simulated time at the end of the step
+  void stateCheckpoint(double currentTime);
+  /// @brief Open the trajectory file of this process, resuming it on a
+  /// restart, and write the initial frame if one is due
+  /// @throw std::runtime_error if a trajectory file cannot be resumed
+  void startTrajectory();
+  /// @brief State of the simulation in wich every process hands the
+  // positions of some of its bodies to the trajectory writer, every
+  // trajectoryInterval steps. Called by the master thread
+  /// @param currentTime Simulated time at the end of the step
+  void stateTrajectory(double currentTime);
+  /// @brief Hand the positions of the sampled bodies of this process to the
+  /// trajectory writer
+  /// @param currentTime Simulated time of the positions
+  void writeTrajectoryFrame(double currentTime);
   /// @brief State of the simulation in wich all processes
   // update the velocities and positions of each body
-  void statePositions();
+  /// @param kickTime Duration the accelerations act on the velocities
+  void statePositions(double kickTime);
+  /// @brief Passes blocks of bodies around a ring of processes: in each
+  /// step every process sends the block it holds to the next process while
+  /// processing it, and receives the block of the previous one
+  /// @param myBodies Serialized bodies of this process, consumed
+  /// @param tag MPI tag of the messages
+  /// @param process Called once with the block of every other process, as a
+  /// std::vector<Type>&, and the rank owning it
+  /// @param local Called once by the team while the first block travels,
+  /// before any call to process
+  template <typename Type, typename Process, typename Local>
+  void ringExchange(std::vector<Type>& myBodies, const int tag,
+    const Process& process, const Local& local);
+  /// @brief Converts a block of serialized collision data into serialized
+  /// acceleration data of its active bodies
+  /// @param collisionBodies Serialized collision data of a process
+  /// @param changes Mass changes of that process, see
+  /// Universe::serializeMassChanges. Bodies with mass zero are left out
+  /// @param changeCount Number of pairs in changes
+  /// @param accelerationBodies Vector where the acceleration data is added
+  static void applyMassChanges(std::vector<double>& collisionBodies,
+    const double* changes, size_t changeCount,
+    std::vector<double>& accelerationBodies);
+  /// @brief Polls the pending transfers until they complete, so they
+  /// advance while the other threads compute. Called by the master thread
+  void progressTransfers();
+  /// @brief Get the buffers of the given precision
+  template <typename Type>
+  ExchangeBuffers<Type>& getBuffers();
+  /// @brief Adds to remoteBodies the acceleration data of a process after
+  /// applying its mass changes, see applyMassChanges. Single thread
+  /// @param rank Process whose gathered data is used
+  void applyRemoteMassChanges(int rank);
+  /// @brief Gathers the blocks of bodies of all processes in one collective
+  /// and processes the blocks of the others in rank order
+  /// @param myBodies Serialized bodies of this process
+  /// @param process Called once with the block of every other process, as a
+  /// std::vector<Type>&, and the rank owning it
+  template <typename Type, typename Process>
+  void gatherExchange(const std::vector<Type>& myBodies,
+    const Process& process);
 
  private:
-  /// @brief Processes take turns reporting the final states of their universe
+  /// @brief Processes write the final states of their bodies to a TSV file
+  /// at once, with collective MPI-IO
   /// @param simulatedTime Total time simulated
   void saveFinalState(double simulatedTime);
+  /// @brief Processes write their bodies to a binary universe file at once,
+  /// in the order they were loaded
+  /// @param fileName Path of the binary file
+  void saveBinaryState(const std::string& fileName);
+  /// @brief Load the bodies of the latest checkpoint of the universe file,
+  /// split among processes as in the universe file
+  void loadCheckpoint();
   /// @brief Generate a report of mean and standard deviation of distances and
   // velocities.
   /// @param totalActiveBodiesCount The total number of active bodies at the
@@ -2,78 +2,127 @@
 
 #include "Statistics.hpp"
 
-#include <omp.h>
+#include <algorithm>
 #include <vector>
 
 #include "common.hpp"
 #include "Mpi.hpp"
 #include "RealVector.hpp"
 
-// CREATED USING CHATGPT
-// This declaration defines a custom reduction for RealVector
-// The behavior for the reduction is omp_out = omp_out + omp_in
-// The private reduction variable is defined with initializer, where
-// It will start as a vector of DIM dimensions, full of zeroes
-#pragma omp declare reduction(vec_sum : RealVector : omp_out = omp_out + \
-    omp_in) initializer(omp_priv = RealVector())
+// Doubles of serialized Moments: count, mean and squares
+#define MOMENTS_DATA_SIZE 7
 
-RealVector Statistics::realVectorMeanDistributed(Mpi* mpi,
-    const std::vector<RealVector>& realVectors, const int total) {
-  // First calculate total sum of this process' vector of real vectors
-  std::vector<double> localSum = Statistics::calculateVectorsSum(realVectors);
-  // Prepare buffer for sum result
-  std::vector<double> sumResult = std::vector<double>(DIM, 0.0);
-  // Reduce the total sum with other process' sum
-  mpi->allReduce(localSum, sumResult, MPI_SUM);
-  // Divide each component by total
-  return RealVector(sumResult) * (1.0 / total);
+/// @brief Serialize moments to send them to other processes
+static void serializeMoments(const Statistics::Moments& moments,
+    double* serialized) {
+  serialized[0] = moments.count;
+  serialized[1] = moments.mean.x;
+  serialized[2] = moments.mean.y;
+  serialized[3] = moments.mean.z;
+  serialized[4] = moments.squares.x;
+  serialized[5] = moments.squares.y;
+  serialized[6] = moments.squares.z;
 }
 
-std::vector<double>  Statistics::calculateVectorsSum(
-    const std::vector<RealVector>& realVectors) {
-  // First create a 3D real vector with 0s
-  RealVector sum = RealVector();
-  // Parallel for to reduce the sum with custom reduction vec_sum
-  #pragma omp parallel for num_threads(omp_get_max_threads()) \
-    default(none) shared(realVectors) reduction(vec_sum:sum)
-  for (size_t index = 0; index < realVectors.size(); ++index) {
-    sum = sum + realVectors[index];
+/// @brief Build moments from serialized data
+static Statistics::Moments deserializeMoments(const double* serialized) {
+  Statistics::Moments moments;
+  moments.count = serialized[0];
+  moments.mean = RealVector(serialized[1], serialized[2], serialized[3]);
+  moments.squares = RealVector(serialized[4], serialized[5], serialized[6]);
+  return moments;
+}
+
+/// @brief MPI operation that merges arrays of serialized moments
+static void mergeSerializedMoments(void* input, void* inputOutput,
+    int* length, MPI_Datatype* /*type*/) {
+  const double* records = static_cast<const double*>(input);
+  double* results = static_cast<double*>(inputOutput);
+  for (int index = 0; index < *length; ++index) {
+    const size_t offset = index * MOMENTS_DATA_SIZE;
+    Statistics::Moments moments = deserializeMoments(results + offset);
+    moments.merge(deserializeMoments(records + offset));
+    serializeMoments(moments, results + offset);
+  }
+}
+
+void Statistics::Moments::add(const RealVector& value) {
+  this->count += 1.0;
+  const RealVector delta = value - this->mean;
+  this->mean = this->mean + delta * (1.0 / this->count);
+  this->squares = this->squares + delta * (value - this->mean);
+}
+
+void Statistics::Moments::merge(const Moments& other) {
+  if (other.count == 0.0) {
+    return;
+  }
+  const double count = this->count + other.count;
+  const RealVector delta = other.mean - this->mean;
+  this->mean = this->mean + delta * (other.count / count);
+  this->squares = this->squares + other.squares + delta * delta *
+    (this->count * other.count / count);
+  this->count = count;
+}
+
+Statistics::Moments Statistics::momentsDistributed(Mpi* mpi,
+    const Moments& local) {
+  std::vector<double> serialized(MOMENTS_DATA_SIZE);
+  serializeMoments(local, serialized.data());
+  std::vector<double> merged(MOMENTS_DATA_SIZE);
+  // Means and squares cannot be added, so MPI merges them as moments
+  mpi->allReduce(serialized, merged, MOMENTS_DATA_SIZE,
+    mergeSerializedMoments);
+  return deserializeMoments(merged.data());
+}
+
+Statistics::Moments Statistics::pairwiseMomentsDistributed(Mpi* mpi,
+    const Moments& local, const RealVector& rankedSum) {
+  // Vectors in the processes before this one
+  double offset = 0.0;
+  mpi->exclusiveScan(local.count, offset, MPI_SUM, 0.0);
+  const Moments all = Statistics::momentsDistributed(mpi, local);
+  const double count = all.count;
+  // The vector ranked r overall is first in count - 1 - r pairs and second
+  // in r pairs
+  const RealVector localSum = local.mean * (local.count *
+    (count - 1.0 - 2.0 * offset)) - rankedSum * 2.0;
+  std::vector<double> serializedSum = {localSum.x, localSum.y, localSum.z};
+  std::vector<double> sum(BODY_DISTANCE_DATA_SIZE);
+  mpi->allReduce(serializedSum, sum, MPI_SUM);
+  Moments pairs;
+  pairs.count = count * (count - 1.0) / 2.0;
+  if (pairs.count == 0.0) {
+    return pairs;
   }
-  return {sum.x, sum.y, sum.z};
+  pairs.mean = RealVector(sum) * (1.0 / pairs.count);
+  // Squared differences of the pairs around 0, moved to their mean. Rounding
+  // may leave them slightly negative when the differences barely vary
+  const RealVector squares = all.squares * count - pairs.mean * pairs.mean *
+    pairs.count;
+  pairs.squares = RealVector(std::max(squares.x, 0.0),
+    std::max(squares.y, 0.0), std::max(squares.z, 0.0));
+  return pairs;
 }
 
-RealVector Statistics::realVectorStDevDistributed(Mpi* mpi,
-    const std::vector<RealVector>& realVectors, RealVector& mean,
+RealVector Statistics::realVectorMean(const Moments& moments,
     const int total) {
+  // Divide the sum of the vectors by total
+  return moments.mean * (moments.count / total);
+}
+
+RealVector Statistics::realVectorStDev(const Moments& moments,
+    const RealVector& mean, const int total) {
   // If total is 1, no standard deviation can be calculated
   if (total <= 1) {
       return RealVector();
   }
-
-  // Sum the (value - mean)^2
-  std::vector<double> stDevSum = Statistics::calculateStDevSum(realVectors,
-      mean);
-  // Buffer for total sum result with other processes
-  std::vector<double> sumResult = std::vector<double>(DIM,
-      0.0);
-  // Reduce the serialized stdev sum across all processes
-  mpi->allReduce(stDevSum, sumResult, MPI_SUM);
+  // Sum the (value - mean)^2, moving the squares from the mean of the
+  // vectors to the given one
+  const RealVector shift = moments.mean - mean;
+  RealVector sum = moments.squares + shift * shift * moments.count;
   // Remove mean
   int degreesOfFreedom = total - 1;
   // Divide by degrees of freedom and square root
-  return (RealVector(sumResult) * (1.0 / degreesOfFreedom)).pow(0.5);
-}
-
-std::vector<double>  Statistics::calculateStDevSum(
-    const std::vector<RealVector>& realVectors, RealVector& mean) {
-  // First create a real vector of 0s
-  RealVector sum = RealVector();
-  // Sum each (value - mean)^2
-  // Parallel for to reduce the sum with vec_sum
-  #pragma omp parallel for num_threads(omp_get_max_threads()) \
-    default(none) shared(realVectors, mean) reduction(vec_sum:sum)
-  for (size_t index = 0; index < realVectors.size(); ++index) {
-    sum = sum + (realVectors[index] - mean).pow(2);
-  }
-  return {sum.x, sum.y, sum.z};
+  return (sum * (1.0 / degreesOfFreedom)).pow(0.5);
 }
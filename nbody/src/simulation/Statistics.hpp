@@ -15,57 +15,92 @@ class Mpi;
 /**
  * @class Statistics
  * @brief Provides statistical calculations for N-body simulations
- * 
+ *
  * This class handles distributed computation of statistics like mean
- * and standard deviation across MPI processes.
+ * and standard deviation across MPI processes. Values are accumulated one
+ * at a time in Moments, so they never have to be stored.
  */
 class Statistics {
   DISABLE_COPY(Statistics);
   Statistics() = delete;
   ~Statistics() = delete;
 
- public:  // MEAN
+ public:  // MOMENTS
   /**
-   * @brief Calculates the average of RealVectors across all MPI processes
-   * @param mpi The MPI communication interface
-   * @param realVectors The local vectors to include in calculation
-   * @param total The total number of elements across all processes
-   * @return RealVector containing the mean values
+   * @brief Count, mean and sum of squared differences from the mean of the
+   * RealVectors added so far, updated in one pass (Welford's method)
    */
-  static RealVector realVectorMeanDistributed(Mpi* mpi,
-      const std::vector<RealVector>& realVectors, const int total);
+  struct Moments {
+    /// Number of vectors added
+    double count = 0.0;
+    /// Mean of the vectors added
+    RealVector mean;
+    /// Sum of the squared differences of the vectors from their mean
+    RealVector squares;
+
+    /**
+     * @brief Adds a vector to the moments
+     * @param value The vector to add
+     */
+    void add(const RealVector& value);
+    /**
+     * @brief Adds the vectors of other moments, as if added one by one
+     * (parallel algorithm of Chan et al.)
+     * @param other The moments to merge into these
+     */
+    void merge(const Moments& other);
+  };
 
- private:  // MEAN HELPER
   /**
-   * @brief Calculates the sum of all vectors in the local process
-   * @param realVectors The vectors to sum
-   * @return vector containing the component-wise sum
+   * @brief Merges the moments of all MPI processes, with one all-reduce
+   * @param mpi The MPI communication interface
+   * @param local The moments of this process
+   * @return Moments of the vectors of every process
    */
-  static std::vector<double> calculateVectorsSum(
-      const std::vector<RealVector>& realVectors);
+  static Moments momentsDistributed(Mpi* mpi, const Moments& local);
 
- public:  // STDEV
   /**
-   * @brief Calculates standard deviation across all MPI processes
+   * @brief Calculates in closed form the moments of the differences of
+   * every pair of vectors of all MPI processes, in O(N) per process
+   *
+   * Vectors are ordered by process and then locally, and each pair gives
+   * the first minus the second. A vector is first in a pair with every later
+   * vector and second with every earlier one, so the sum of the differences
+   * weighs each vector by their difference. The squared differences from
+   * the mean of all pairs add up to the number of vectors times the ones of
+   * the vectors.
    * @param mpi The MPI communication interface
-   * @param realVectors The local vectors to include in calculation
-   * @param mean The pre-calculated mean vector
-   * @param total The total number of elements across all processes
-   * @return RealVector containing the standard deviations
+   * @param local The moments of the vectors of this process
+   * @param rankedSum Sum of the vectors of this process, each multiplied by
+   * the number of vectors before it in this process
+   * @return Moments of the differences of every pair of vectors
    */
-  static RealVector realVectorStDevDistributed(Mpi* mpi,
-    const std::vector<RealVector>& realVectors, RealVector& mean,
-    const int total);
+  static Moments pairwiseMomentsDistributed(Mpi* mpi, const Moments& local,
+    const RealVector& rankedSum);
 
- private:  // STDEV HELPER
+ public:  // MEAN
   /**
-   * @brief Calculates sum of squared differences from mean for local vectors
-   * @param realVectors The vectors to process
-   * @param mean The mean vector to compare against
-   * @return RealVector containing sum of squared differences
+   * @brief Calculates the average of the vectors of some moments
+   * @param moments The moments of the vectors across all MPI processes
+   * @param total The number of elements the sum of the vectors is divided by
+   * @return RealVector containing the mean values
+   */
+  static RealVector realVectorMean(const Moments& moments, const int total);
+
+ public:  // STDEV
+  /**
+   * @brief Calculates the standard deviation of the vectors of some moments
+   * @param moments The moments of the vectors across all MPI processes
+   * @param mean The pre-calculated mean vector
+   * @param total The total number of elements, minus one degree of freedom
+   * @return RealVector containing the standard deviations
    */
-  static std::vector<double> calculateStDevSum(
-      const std::vector<RealVector>& realVectors, RealVector& mean);
+  static RealVector realVectorStDev(const Moments& moments,
+    const RealVector& mean, const int total);
 };
 
+// Merges the moments accumulated by each thread of a parallel for
+#pragma omp declare reduction(moments_merge : Statistics::Moments : \
+    omp_out.merge(omp_in)) initializer(omp_priv = Statistics::Moments())
+
 #endif  // STATISTICS_HPP
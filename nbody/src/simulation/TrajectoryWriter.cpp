@@ -0,0 +1,170 @@
+// Copyright 2025 Stockholm Syndrome. Universidad de Costa Rica. CC BY 4.0
+
+#include "TrajectoryWriter.hpp"
+
+#include <unistd.h>  // NOLINT[BUILD-LACK_INCLUDE_SCORE_ORDER]
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+TrajectoryWriter::~TrajectoryWriter() {
+  try {
+    this->close();
+  } catch (const std::runtime_error&) {
+    // Reported by run() when it calls close()
+  }
+}
+
+std::string TrajectoryWriter::getFileName(const std::string& stem,
+    int rank) {
+  return stem + "-trajectory-" + std::to_string(rank) + ".bin";
+}
+
+void TrajectoryWriter::open(const std::string& fileName, uint64_t bodyCount,
+    uint64_t stride, bool append) {
+  if (append) {
+    this->file.open(fileName, std::ios::binary | std::ios::app);
+  } else {
+    this->file.open(fileName, std::ios::binary | std::ios::trunc);
+    this->file.write(TRAJECTORY_MAGIC, TRAJECTORY_MAGIC_SIZE);
+    this->file.write(reinterpret_cast<const char*>(&bodyCount),
+      sizeof bodyCount);
+    this->file.write(reinterpret_cast<const char*>(&stride), sizeof stride);
+  }
+  if (!this->file) {
+    throw std::runtime_error("could not create trajectory " + fileName);
+  }
+  this->writer = std::thread(&TrajectoryWriter::run, this);
+}
+
+bool TrajectoryWriter::truncate(const std::string& fileName,
+    uint64_t bodyCount, uint64_t stride, double time) {
+  std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+  if (!file) {
+    return false;
+  }
+  const uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+  file.seekg(0);
+  char magic[TRAJECTORY_MAGIC_SIZE] = {};
+  uint64_t header[2] = {};
+  file.read(magic, sizeof magic);
+  file.read(reinterpret_cast<char*>(header), sizeof header);
+  if (!file || std::memcmp(magic, TRAJECTORY_MAGIC, sizeof magic) != 0 ||
+      header[0] != bodyCount || header[1] != stride) {
+    throw std::runtime_error(fileName + " is not a trajectory of the same "
+      "bodies and stride");
+  }
+  // Skip the frames before time, keeping the end of the last complete one
+  uint64_t end = TRAJECTORY_MAGIC_SIZE + sizeof header;
+  while (true) {
+    double frameTime = 0.0;
+    uint64_t count = 0;
+    file.seekg(end);
+    file.read(reinterpret_cast<char*>(&frameTime), sizeof frameTime);
+    file.read(reinterpret_cast<char*>(&count), sizeof count);
+    // Time and count, box, and then ids and steps of each body
+    const uint64_t frameSize = sizeof frameTime + sizeof count +
+      2 * BODY_DISTANCE_DATA_SIZE * sizeof(double) + count *
+      (sizeof(uint32_t) + BODY_DISTANCE_DATA_SIZE * sizeof(uint16_t));
+    if (!file || frameTime >= time || count > fileSize ||
+        end + frameSize > fileSize) {
+      break;
+    }
+    end += frameSize;
+  }
+  file.close();
+  if (end < fileSize && ::truncate(fileName.c_str(),
+      static_cast<off_t>(end)) != 0) {
+    throw std::runtime_error("could not cut trajectory " + fileName);
+  }
+  return true;
+}
+
+void TrajectoryWriter::push(TrajectoryFrame& frame) {
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->changed.wait(lock, [this] {
+      return this->queue.size() < TRAJECTORY_QUEUE_CAPACITY;
+    });
+    if (!this->error.empty()) {
+      throw std::runtime_error(this->error);
+    }
+    this->queue.emplace_back(std::move(frame));
+  }
+  this->changed.notify_all();
+}
+
+void TrajectoryWriter::close() {
+  if (!this->writer.joinable()) {
+    return;  // Not open
+  }
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->stopping = true;
+  }
+  this->changed.notify_all();
+  this->writer.join();
+  this->file.close();
+  if (!this->error.empty()) {
+    throw std::runtime_error(this->error);
+  }
+}
+
+void TrajectoryWriter::run() {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  while (true) {
+    this->changed.wait(lock, [this] {
+      return !this->queue.empty() || this->stopping;
+    });
+    if (this->queue.empty()) {
+      break;  // Stopping with every frame written
+    }
+    const TrajectoryFrame frame = std::move(this->queue.front());
+    this->queue.pop_front();
+    // The simulation may queue more frames meanwhile
+    lock.unlock();
+    this->changed.notify_all();
+    this->writeFrame(frame);
+    lock.lock();
+    if (!this->file && this->error.empty()) {
+      this->error = "could not write trajectory frame";
+    }
+  }
+}
+
+void TrajectoryWriter::writeFrame(const TrajectoryFrame& frame) {
+  const size_t axes = BODY_DISTANCE_DATA_SIZE;
+  const uint64_t count = frame.ids.size();
+  // Positions are stored as steps of 1/65535 of the box of the frame
+  double lows[axes];
+  double steps[axes];
+  for (size_t axis = 0; axis < axes; ++axis) {
+    double low = std::numeric_limits<double>::max();
+    double high = std::numeric_limits<double>::lowest();
+    for (size_t body = 0; body < count; ++body) {
+      low = std::min(low, frame.positions[body * axes + axis]);
+      high = std::max(high, frame.positions[body * axes + axis]);
+    }
+    lows[axis] = count > 0 ? low : 0.0;
+    steps[axis] = count > 0 && high > low ? (high - low) /
+      std::numeric_limits<uint16_t>::max() : 1.0;
+  }
+  std::vector<uint16_t> quantized(count * axes);
+  for (size_t index = 0; index < quantized.size(); ++index) {
+    quantized[index] = static_cast<uint16_t>((frame.positions[index] -
+      lows[index % axes]) / steps[index % axes] + 0.5);
+  }
+  this->file.write(reinterpret_cast<const char*>(&frame.time),
+    sizeof frame.time);
+  this->file.write(reinterpret_cast<const char*>(&count), sizeof count);
+  this->file.write(reinterpret_cast<const char*>(lows), sizeof lows);
+  this->file.write(reinterpret_cast<const char*>(steps), sizeof steps);
+  this->file.write(reinterpret_cast<const char*>(frame.ids.data()),
+    count * sizeof(uint32_t));
+  this->file.write(reinterpret_cast<const char*>(quantized.data()),
+    quantized.size() * sizeof(uint16_t));
+}
@@ -0,0 +1,108 @@
+// Copyright 2025 Stockholm Syndrome. Universidad de Costa Rica. CC BY 4.0
+
+#ifndef TRAJECTORYWRITER_HPP
+#define TRAJECTORYWRITER_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common.hpp"
+
+/// @brief Positions of some bodies of a process at a simulated time
+struct TrajectoryFrame {
+  /// Simulated time of the frame
+  double time = 0.0;
+  /// Position of each body in the universe file
+  std::vector<uint32_t> ids;
+  /// Position components of each body, x, y and z
+  std::vector<double> positions;
+};
+
+/// @class TrajectoryWriter
+/// @brief Appends frames of bodies' positions to a trajectory file of a
+/// process in a background thread
+/// @details The simulation pushes frames to a bounded queue, and a thread
+/// quantizes and writes them. Pushing only waits when the queue is full,
+/// so memory stays bounded if the disk falls behind.
+///
+/// The file starts with TRAJECTORY_MAGIC, the 64 bits bodies count and
+/// subsampling stride. Each frame follows as its time (double), its bodies
+/// count (64 bits), the low corner of the box of its bodies and the size
+/// of a quantization step per axis (3 doubles each), the 32 bits id of
+/// each body, and then 3 unsigned 16 bits steps from the low corner per
+/// body. A restarted run cuts the frames from its checkpoint on with
+/// truncate() and appends to the file.
+class TrajectoryWriter {
+  DISABLE_COPY(TrajectoryWriter);
+
+ private:
+  /// Quantizes and writes the queued frames, started by open()
+  std::thread writer;
+  /// Protects the members shared with the writer
+  std::mutex mutex;
+  /// Signals a frame was queued or written
+  std::condition_variable changed;
+  /// Frames waiting to be written, at most TRAJECTORY_QUEUE_CAPACITY
+  std::deque<TrajectoryFrame> queue;
+  /// True when the writer must finish after emptying the queue
+  bool stopping = false;
+  /// Output file, only used by the writer
+  std::ofstream file;
+  /// Error of the writer, reported by the next call
+  std::string error;
+
+ public:
+  /// @brief Default constructor, the writer thread starts with open()
+  TrajectoryWriter() = default;
+  /// @brief Write the queued frames and stop the writer thread
+  ~TrajectoryWriter();
+
+  /// @brief Get the name of the trajectory file of a process
+  /// @param stem Universe file name without its extension
+  /// @param rank Rank of the process
+  static std::string getFileName(const std::string& stem, int rank);
+
+  /// @brief Create the file and write its header, or append to it, and start
+  /// the writer thread
+  /// @param fileName Path of the trajectory file
+  /// @param bodyCount Number of bodies in the universe
+  /// @param stride Only bodies whose id is a multiple of it are written
+  /// @param append True to add frames to a file cut by truncate()
+  /// @throw std::runtime_error if the file cannot be created
+  void open(const std::string& fileName, uint64_t bodyCount,
+    uint64_t stride, bool append);
+
+  /// @brief Cut the frames of a trajectory file from a simulated time on,
+  /// and any frame left incomplete, to resume it from a checkpoint
+  /// @param fileName Path of the trajectory file
+  /// @param bodyCount,stride Values the file header must have
+  /// @param time Frames at this time or later are removed
+  /// @return false if the file does not exist
+  /// @throw std::runtime_error if the file is not a trajectory of the same
+  /// bodies and stride, or cannot be cut
+  static bool truncate(const std::string& fileName, uint64_t bodyCount,
+    uint64_t stride, double time);
+
+  /// @brief Queue a frame, waiting if the queue is full
+  /// @param frame Frame to write, its buffers are taken
+  /// @throw std::runtime_error if writing a frame failed
+  void push(TrajectoryFrame& frame);
+
+  /// @brief Wait until every queued frame is written and close the file
+  /// @throw std::runtime_error if writing a frame failed
+  void close();
+
+ private:
+  /// @brief Body of the writer thread
+  void run();
+  /// @brief Quantize the positions of a frame and write it to the file
+  void writeFrame(const TrajectoryFrame& frame);
+};
+
+#endif  // TRAJECTORYWRITER_HPP
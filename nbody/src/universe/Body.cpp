@@ -8,9 +8,9 @@
 
 // Constructor - initializes body properties
 Body::Body(const double mass, const double radius, const RealVector& position,
-    const RealVector& velocity):
+    const RealVector& velocity, const RealVector& acceleration):
   mass(mass), radius(radius), position(position), velocity(velocity),
-    acceleration() {
+    acceleration(acceleration) {
 }
 
 // Combines two radii using volume conservation (r^3 addition)
@@ -186,6 +186,21 @@ const RealVector& Body::getVelocity() const {
   return this->velocity;
 }
 
+// Returns mass, negative if the body is inactive
+double Body::getMass() const {
+  return this->mass;
+}
+
+// Returns radius
+double Body::getRadius() const {
+  return this->radius;
+}
+
+// Returns acceleration vector
+const RealVector& Body::getAcceleration() const {
+  return this->acceleration;
+}
+
 // Returns formatted string representation of body properties
 std::string Body::toString() {
   std::stringstream bodyStream;
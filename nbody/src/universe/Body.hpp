@@ -32,7 +32,7 @@ class Body {
  public:
   /// @brief Constructor for the Body class.
   Body(const double mass, const double radius, const RealVector& position,
-    const RealVector& velocity);
+    const RealVector& velocity, const RealVector& acceleration = RealVector());
 
  public:
   /// @brief Update the acceleration of the body, with separated mass and pos
@@ -156,9 +156,18 @@ class Body {
   /// @param serialized Vector to store the serialized data
   void serializeVelocityData(std::vector<double>& serialized) const;
 
+  /// @brief Get the mass of the body
+  double getMass() const;
+
+  /// @brief Get the radius of the body
+  double getRadius() const;
+
   /// @brief Get the velocity of the body
   const RealVector& getVelocity() const;
 
+  /// @brief Get the acceleration of the body
+  const RealVector& getAcceleration() const;
+
   /// @brief Get the position of the body
   const RealVector& getPosition() const;
 
@@ -0,0 +1,267 @@
+// Copyright 2025 Stockholm Syndrome. Universidad de Costa Rica. CC BY 4.0
+
+#include "BodyStore.hpp"
+
+#include <cmath>
+#include <omp.h>  // NOLINT[BUILD-LACK_INCLUDE_SCORE_ORDER]
+#include <vector>
+
+#include "common.hpp"
+
+// Reserves room in every property array
+void BodyStore::reserve(size_t capacity) {
+  this->masses.reserve(capacity);
+  this->radiuses.reserve(capacity);
+  this->positionsX.reserve(capacity);
+  this->positionsY.reserve(capacity);
+  this->positionsZ.reserve(capacity);
+  this->velocitiesX.reserve(capacity);
+  this->velocitiesY.reserve(capacity);
+  this->velocitiesZ.reserve(capacity);
+  this->accelerationsX.reserve(capacity);
+  this->accelerationsY.reserve(capacity);
+  this->accelerationsZ.reserve(capacity);
+  this->actives.reserve(capacity);
+}
+
+// Empties every property array
+void BodyStore::clear() {
+  this->masses.clear();
+  this->radiuses.clear();
+  this->positionsX.clear();
+  this->positionsY.clear();
+  this->positionsZ.clear();
+  this->velocitiesX.clear();
+  this->velocitiesY.clear();
+  this->velocitiesZ.clear();
+  this->accelerationsX.clear();
+  this->accelerationsY.clear();
+  this->accelerationsZ.clear();
+  this->actives.clear();
+}
+
+// Scatters the properties of the body into the arrays
+void BodyStore::pushBack(const Body& body) {
+  this->masses.push_back(body.getMass());
+  this->radiuses.push_back(body.getRadius());
+  this->positionsX.push_back(body.getPosition().x);
+  this->positionsY.push_back(body.getPosition().y);
+  this->positionsZ.push_back(body.getPosition().z);
+  this->velocitiesX.push_back(body.getVelocity().x);
+  this->velocitiesY.push_back(body.getVelocity().y);
+  this->velocitiesZ.push_back(body.getVelocity().z);
+  this->accelerationsX.push_back(body.getAcceleration().x);
+  this->accelerationsY.push_back(body.getAcceleration().y);
+  this->accelerationsZ.push_back(body.getAcceleration().z);
+  this->actives.push_back(body.isActive());
+}
+
+void BodyStore::appendRecords(const double* records, size_t count) {
+  const size_t first = this->size();
+  this->resize(first + count);
+  #pragma omp parallel for num_threads(omp_get_max_threads()) \
+    schedule(static) default(none) shared(records, count, first)
+  for (size_t record = 0; record < count; ++record) {
+    this->setRecord(first + record, records + record *
+      BODY_COLLISION_DATA_SIZE);
+  }
+}
+
+void BodyStore::copyBody(size_t from, size_t to) {
+  this->masses[to] = this->masses[from];
+  this->radiuses[to] = this->radiuses[from];
+  this->positionsX[to] = this->positionsX[from];
+  this->positionsY[to] = this->positionsY[from];
+  this->positionsZ[to] = this->positionsZ[from];
+  this->velocitiesX[to] = this->velocitiesX[from];
+  this->velocitiesY[to] = this->velocitiesY[from];
+  this->velocitiesZ[to] = this->velocitiesZ[from];
+  this->accelerationsX[to] = this->accelerationsX[from];
+  this->accelerationsY[to] = this->accelerationsY[from];
+  this->accelerationsZ[to] = this->accelerationsZ[from];
+  this->actives[to] = this->actives[from];
+}
+
+void BodyStore::resize(size_t count) {
+  this->masses.resize(count);
+  this->radiuses.resize(count);
+  this->positionsX.resize(count);
+  this->positionsY.resize(count);
+  this->positionsZ.resize(count);
+  this->velocitiesX.resize(count);
+  this->velocitiesY.resize(count);
+  this->velocitiesZ.resize(count);
+  this->accelerationsX.resize(count);
+  this->accelerationsY.resize(count);
+  this->accelerationsZ.resize(count);
+  this->actives.resize(count);
+}
+
+// Gathers the properties at index into a body
+Body BodyStore::getBody(size_t index) const {
+  return Body(this->masses[index], this->radiuses[index],
+    this->getPosition(index), this->getVelocity(index),
+    RealVector(this->accelerationsX[index], this->accelerationsY[index],
+      this->accelerationsZ[index]));
+}
+
+// Same formula as Body::updateAcceleration, without temporary vectors
+void BodyStore::updateAcceleration(size_t index, double otherMass,
+    double otherX, double otherY, double otherZ) {
+  const double distanceX = otherX - this->positionsX[index];
+  const double distanceY = otherY - this->positionsY[index];
+  const double distanceZ = otherZ - this->positionsZ[index];
+  const double distanceMagnitude = std::sqrt(distanceX * distanceX +
+    distanceY * distanceY + distanceZ * distanceZ);
+  if (distanceMagnitude == 0) {  // Avoid division by zero
+    return;
+  }
+  const double factor = otherMass / std::pow(distanceMagnitude, 3);
+  this->accelerationsX[index] = this->accelerationsX[index] +
+    distanceX * factor;
+  this->accelerationsY[index] = this->accelerationsY[index] +
+    distanceY * factor;
+  this->accelerationsZ[index] = this->accelerationsZ[index] +
+    distanceZ * factor;
+}
+
+void BodyStore::updateAcceleration(size_t index, size_t otherIndex) {
+  this->updateAcceleration(index, this->masses[otherIndex],
+    this->positionsX[otherIndex], this->positionsY[otherIndex],
+    this->positionsZ[otherIndex]);
+}
+
+void BodyStore::updateAcceleration(size_t index,
+    const ForceSources& sources) {
+  double accelerations[DIM] = {this->accelerationsX[index],
+    this->accelerationsY[index], this->accelerationsZ[index]};
+  ForceKernel::accumulate(sources, this->positionsX[index],
+    this->positionsY[index], this->positionsZ[index], accelerations);
+  this->accelerationsX[index] = accelerations[0];
+  this->accelerationsY[index] = accelerations[1];
+  this->accelerationsZ[index] = accelerations[2];
+}
+
+void BodyStore::updateAcceleration(size_t index,
+    const FloatForceSources& sources) {
+  double accelerations[DIM] = {this->accelerationsX[index],
+    this->accelerationsY[index], this->accelerationsZ[index]};
+  ForceKernel::accumulate(sources, static_cast<float>(this->positionsX[index]),
+    static_cast<float>(this->positionsY[index]),
+    static_cast<float>(this->positionsZ[index]), accelerations);
+  this->accelerationsX[index] = accelerations[0];
+  this->accelerationsY[index] = accelerations[1];
+  this->accelerationsZ[index] = accelerations[2];
+}
+
+ForceSources BodyStore::getSources(const std::vector<double>& sourceMasses)
+    const {
+  ForceSources sources;
+  sources.masses = sourceMasses.data();
+  sources.positionsX = this->positionsX.data();
+  sources.positionsY = this->positionsY.data();
+  sources.positionsZ = this->positionsZ.data();
+  sources.count = this->size();
+  return sources;
+}
+
+void BodyStore::resetAcceleration(size_t index) {
+  this->accelerationsX[index] = 0.0;
+  this->accelerationsY[index] = 0.0;
+  this->accelerationsZ[index] = 0.0;
+}
+
+// v = v0 + a*t (with gravitational constant G factored in)
+void BodyStore::updateVelocity(size_t index, double deltaTime) {
+  this->velocitiesX[index] = this->velocitiesX[index] +
+    (this->accelerationsX[index] * G) * deltaTime;
+  this->velocitiesY[index] = this->velocitiesY[index] +
+    (this->accelerationsY[index] * G) * deltaTime;
+  this->velocitiesZ[index] = this->velocitiesZ[index] +
+    (this->accelerationsZ[index] * G) * deltaTime;
+}
+
+// x = x0 + v*t
+void BodyStore::updatePosition(size_t index, double deltaTime) {
+  this->positionsX[index] = this->positionsX[index] +
+    this->velocitiesX[index] * deltaTime;
+  this->positionsY[index] = this->positionsY[index] +
+    this->velocitiesY[index] * deltaTime;
+  this->positionsZ[index] = this->positionsZ[index] +
+    this->velocitiesZ[index] * deltaTime;
+}
+
+// Collision occurs if distance between centers < sum of radii
+bool BodyStore::checkCollision(size_t index, double otherRadius,
+    double otherX, double otherY, double otherZ) const {
+  const double distanceX = otherX - this->positionsX[index];
+  const double distanceY = otherY - this->positionsY[index];
+  const double distanceZ = otherZ - this->positionsZ[index];
+  return std::sqrt(distanceX * distanceX + distanceY * distanceY +
+    distanceZ * distanceZ) < this->radiuses[index] + otherRadius;
+}
+
+bool BodyStore::checkCollision(size_t index, size_t otherIndex) const {
+  return this->checkCollision(index, this->radiuses[otherIndex],
+    this->positionsX[otherIndex], this->positionsY[otherIndex],
+    this->positionsZ[otherIndex]);
+}
+
+// Same merge rules as Body::absorb
+bool BodyStore::absorb(size_t index, double otherMass, double otherRadius,
+    const RealVector& otherVelocity) {
+  if (this->masses[index] < otherMass) {
+    return false;
+  }
+  this->masses[index] += otherMass;
+  this->refreshActive(index);
+  // Combine radiuses using volume conservation (r^3 addition)
+  this->radiuses[index] = std::pow((std::pow(this->radiuses[index], 3) +
+    std::pow(otherRadius, 3)), 1.0 / 3);
+  // Merge velocities using momentum conservation
+  const double inverseMass = 1 / (this->masses[index] + otherMass);
+  this->velocitiesX[index] = (this->velocitiesX[index] * otherMass +
+    otherVelocity.x * otherMass) * inverseMass;
+  this->velocitiesY[index] = (this->velocitiesY[index] * otherMass +
+    otherVelocity.y * otherMass) * inverseMass;
+  this->velocitiesZ[index] = (this->velocitiesZ[index] * otherMass +
+    otherVelocity.z * otherMass) * inverseMass;
+  return true;
+}
+
+bool BodyStore::absorb(size_t index, size_t otherIndex) {
+  if (this->absorb(index, this->masses[otherIndex],
+      this->radiuses[otherIndex], this->getVelocity(otherIndex))) {
+    this->deactivate(otherIndex);  // Mark other body as inactive
+    return true;
+  }
+  return false;
+}
+
+void BodyStore::deactivate(size_t index) {
+  this->masses[index] *= -1;
+  this->refreshActive(index);
+}
+
+void BodyStore::serializeCheckCollision(size_t index,
+    std::vector<double>& serialized) const {
+  serialized.push_back(this->masses[index]);
+  serialized.push_back(this->radiuses[index]);
+  this->serializePositionData(index, serialized);
+  serialized.push_back(this->velocitiesX[index]);
+  serialized.push_back(this->velocitiesY[index]);
+  serialized.push_back(this->velocitiesZ[index]);
+}
+
+void BodyStore::serializeAccelerationData(size_t index,
+    std::vector<double>& serialized) const {
+  serialized.push_back(this->masses[index]);
+  this->serializePositionData(index, serialized);
+}
+
+void BodyStore::serializePositionData(size_t index,
+    std::vector<double>& serialized) const {
+  serialized.push_back(this->positionsX[index]);
+  serialized.push_back(this->positionsY[index]);
+  serialized.push_back(this->positionsZ[index]);
+}
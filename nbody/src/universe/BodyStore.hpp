@@ -0,0 +1,206 @@
+// Copyright 2025 Stockholm Syndrome. Universidad de Costa Rica. CC BY 4.0
+
+#ifndef BODYSTORE_HPP
+#define BODYSTORE_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "Body.hpp"
+#include "ForceKernel.hpp"
+#include "RealVector.hpp"
+
+/// @brief Structure-of-arrays storage for the bodies of a universe
+/// @details Each property of the bodies is kept in its own contiguous array,
+/// so hot loops that only need positions and masses do not drag velocities,
+/// accelerations and radiuses through the cache. Body objects are only built
+/// as views when a whole body is needed, e.g. for input and output.
+class BodyStore {
+ public:
+  /// Bodies' masses. Inactive bodies have a non-positive mass
+  std::vector<double> masses;
+  /// Bodies' radiuses
+  std::vector<double> radiuses;
+  /// Position components
+  std::vector<double> positionsX;
+  std::vector<double> positionsY;
+  std::vector<double> positionsZ;
+  /// Velocity components
+  std::vector<double> velocitiesX;
+  std::vector<double> velocitiesY;
+  std::vector<double> velocitiesZ;
+  /// Acceleration components
+  std::vector<double> accelerationsX;
+  std::vector<double> accelerationsY;
+  std::vector<double> accelerationsZ;
+  /// 1 if the body is active, 0 otherwise. Kept in sync with masses' sign
+  std::vector<uint8_t> actives;
+
+ public:
+  /// @brief Get the number of stored bodies
+  size_t size() const {
+    return this->masses.size();
+  }
+
+  /// @brief Reserve capacity for the given amount of bodies
+  /// @param capacity Number of bodies expected
+  void reserve(size_t capacity);
+
+  /// @brief Remove all bodies from the store
+  void clear();
+
+  /// @brief Append a body at the end of the store
+  /// @param body Body to copy its properties from
+  void pushBack(const Body& body);
+
+  /// @brief Append bodies from records laid out as CollisionData. The
+  /// properties are scattered in parallel by a team of threads
+  /// @param records BODY_COLLISION_DATA_SIZE doubles per body
+  /// @param count Number of records
+  void appendRecords(const double* records, size_t count);
+
+  /// @brief Overwrite every property of a stored body with a record laid
+  /// out as CollisionData. Threads may set different bodies at once
+  /// @param index Index of the body to overwrite
+  /// @param record BODY_COLLISION_DATA_SIZE doubles
+  void setRecord(size_t index, const double* record) {
+    this->masses[index] = record[COLLISION_MASS];
+    this->radiuses[index] = record[COLLISION_RADIUS];
+    this->positionsX[index] = record[COLLISION_POSITION_X];
+    this->positionsY[index] = record[COLLISION_POSITION_Y];
+    this->positionsZ[index] = record[COLLISION_POSITION_Z];
+    this->velocitiesX[index] = record[COLLISION_VELOCITY_X];
+    this->velocitiesY[index] = record[COLLISION_VELOCITY_Y];
+    this->velocitiesZ[index] = record[COLLISION_VELOCITY_Z];
+    this->refreshActive(index);
+  }
+
+  /// @brief Copy every property of a body over another stored body
+  /// @param from Index of the body to copy
+  /// @param to Index of the body to overwrite
+  void copyBody(size_t from, size_t to);
+
+  /// @brief Keep only the first bodies of the store, or add zeroed ones
+  /// @param count Number of bodies the store will hold
+  void resize(size_t count);
+
+  /// @brief Build a body view with the properties stored at an index
+  /// @param index Index of the body
+  /// @return Copy of the body stored at index
+  Body getBody(size_t index) const;
+
+  /// @brief Check if the body at index is active
+  bool isActive(size_t index) const {
+    return this->actives[index];
+  }
+
+  /// @brief Get the position of a body as a vector
+  RealVector getPosition(size_t index) const {
+    return RealVector(this->positionsX[index], this->positionsY[index],
+      this->positionsZ[index]);
+  }
+
+  /// @brief Get the velocity of a body as a vector
+  RealVector getVelocity(size_t index) const {
+    return RealVector(this->velocitiesX[index], this->velocitiesY[index],
+      this->velocitiesZ[index]);
+  }
+
+ public:  // Physics
+  /// @brief Add the gravitational pull of a mass located at a position
+  /// @param index Index of the body to update
+  /// @param otherMass Mass of the other body
+  /// @param otherX,otherY,otherZ Position of the other body
+  /// @see Body::updateAcceleration
+  void updateAcceleration(size_t index, double otherMass, double otherX,
+    double otherY, double otherZ);
+
+  /// @brief Add the gravitational pull of another stored body
+  /// @see updateAcceleration
+  void updateAcceleration(size_t index, size_t otherIndex);
+
+  /// @brief Add the gravitational pull of many sources with the batched
+  /// kernel
+  /// @param index Index of the body to update
+  /// @param sources Bodies pulling on the body, see ForceKernel
+  void updateAcceleration(size_t index, const ForceSources& sources);
+
+  /// @brief Add the gravitational pull of single precision sources
+  /// @param index Index of the body to update
+  /// @param sources Bodies pulling on the body, see ForceKernel
+  void updateAcceleration(size_t index, const FloatForceSources& sources);
+
+  /// @brief Get the positions of the bodies as force sources
+  /// @param sourceMasses Masses to use, one per body, e.g. with inactive
+  /// bodies masked as zero
+  ForceSources getSources(const std::vector<double>& sourceMasses) const;
+
+  /// @brief Reset the acceleration of a body to zeroes
+  void resetAcceleration(size_t index);
+
+  /// @brief Update the velocity of a body with its acceleration
+  /// @param deltaTime Time step for the update
+  void updateVelocity(size_t index, double deltaTime);
+
+  /// @brief Update the position of a body with its velocity
+  /// @param deltaTime Time step for the update
+  void updatePosition(size_t index, double deltaTime);
+
+  /// @brief Check if a body collides with a sphere
+  /// @param index Index of the body to check
+  /// @param otherRadius Radius of the other body
+  /// @param otherX,otherY,otherZ Position of the other body
+  /// @return true if the bodies collide, false otherwise
+  bool checkCollision(size_t index, double otherRadius, double otherX,
+    double otherY, double otherZ) const;
+
+  /// @brief Check if two stored bodies collide
+  /// @see checkCollision
+  bool checkCollision(size_t index, size_t otherIndex) const;
+
+  /// @brief Absorb another body if this one is at least as massive
+  /// @param index Index of the absorbing body
+  /// @param otherMass Mass of the other body
+  /// @param otherRadius Radius of the other body
+  /// @param otherVelocity Velocity of the other body
+  /// @return true if the body absorbed the other one
+  /// @see Body::absorb
+  bool absorb(size_t index, double otherMass, double otherRadius,
+    const RealVector& otherVelocity);
+
+  /// @brief Absorb another stored body, deactivating it if absorbed
+  /// @see absorb
+  bool absorb(size_t index, size_t otherIndex);
+
+  /// @brief Deactivate the body at index by negating its mass
+  void deactivate(size_t index);
+
+  /// @brief Check if a body's mass is equal to the given one
+  bool equalMasses(size_t index, double otherMass) const {
+    return this->masses[index] == otherMass;
+  }
+
+ public:  // Serialization
+  /// @brief Serialize a body for collision checking
+  /// @see Body::serializeCheckCollision
+  void serializeCheckCollision(size_t index, std::vector<double>& serialized)
+    const;
+
+  /// @brief Serialize a body for acceleration sum
+  /// @see Body::serializeAccelerationData
+  void serializeAccelerationData(size_t index,
+    std::vector<double>& serialized) const;
+
+  /// @brief Serialize a body position
+  /// @see Body::serializePositionData
+  void serializePositionData(size_t index, std::vector<double>& serialized)
+    const;
+
+ private:
+  /// @brief Update the active flag of a body after its mass changed
+  void refreshActive(size_t index) {
+    this->actives[index] = this->masses[index] > 0;
+  }
+};
+
+#endif  // BODYSTORE_HPP
@@ -0,0 +1,540 @@
+// Copyright 2025 Stockholm Syndrome. Universidad de Costa Rica. CC BY 4.0
+
+#include "ForceKernel.hpp"
+
+#include <cmath>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FORCE_KERNEL_X86 1
+#endif
+
+// Adds the pull of sources [start, count[ one at a time. Also used for the
+// remainders of the vectorized versions
+static void accumulateScalar(const ForceSources& sources, size_t start,
+    double x, double y, double z, double* accelerations) {
+  double sumX = 0.0, sumY = 0.0, sumZ = 0.0;
+  for (size_t index = start; index < sources.count; ++index) {
+    const double distanceX = sources.positionsX[index] - x;
+    const double distanceY = sources.positionsY[index] - y;
+    const double distanceZ = sources.positionsZ[index] - z;
+    const double squared = distanceX * distanceX + distanceY * distanceY +
+      distanceZ * distanceZ;
+    // 1/|r|^3 computed as 1/(r^2 * sqrt(r^2)), skipping the body itself
+    const double inverseCube = squared > 0.0 ?
+      1.0 / (squared * std::sqrt(squared)) : 0.0;
+    const double factor = sources.masses[index] * inverseCube;
+    sumX += distanceX * factor;
+    sumY += distanceY * factor;
+    sumZ += distanceZ * factor;
+  }
+  accelerations[0] += sumX;
+  accelerations[1] += sumY;
+  accelerations[2] += sumZ;
+}
+
+// Adds the pull of single precision sources [start, count[ one at a time.
+// Only 1/|r| is computed in single precision, its cube may not fit in it
+static void accumulateFloatScalar(const FloatForceSources& sources,
+    size_t start, float x, float y, float z, double* accelerations) {
+  double sumX = 0.0, sumY = 0.0, sumZ = 0.0;
+  for (size_t index = start; index < sources.count; ++index) {
+    const float distanceX = sources.positionsX[index] - x;
+    const float distanceY = sources.positionsY[index] - y;
+    const float distanceZ = sources.positionsZ[index] - z;
+    const float squared = distanceX * distanceX + distanceY * distanceY +
+      distanceZ * distanceZ;
+    const double inverse = squared > 0.0f ? 1.0f / std::sqrt(squared) : 0.0f;
+    const double factor = sources.masses[index] * (inverse * inverse *
+      inverse);
+    sumX += distanceX * factor;
+    sumY += distanceY * factor;
+    sumZ += distanceZ * factor;
+  }
+  accelerations[0] += sumX;
+  accelerations[1] += sumY;
+  accelerations[2] += sumZ;
+}
+
+// Evaluates the pairs of body index with bodies [start, end[ one at a time.
+// The pull on index is added to sums, the opposite pull on the others is
+// subtracted from their accelerations
+static void accumulatePairsScalar(const ForceSources& bodies, size_t index,
+    size_t start, size_t end, double* const accelerations[],
+    double sums[]) {
+  const double x = bodies.positionsX[index];
+  const double y = bodies.positionsY[index];
+  const double z = bodies.positionsZ[index];
+  const double mass = bodies.masses[index];
+  for (size_t other = start; other < end; ++other) {
+    const double distanceX = bodies.positionsX[other] - x;
+    const double distanceY = bodies.positionsY[other] - y;
+    const double distanceZ = bodies.positionsZ[other] - z;
+    const double squared = distanceX * distanceX + distanceY * distanceY +
+      distanceZ * distanceZ;
+    const double inverseCube = squared > 0.0 ?
+      1.0 / (squared * std::sqrt(squared)) : 0.0;
+    const double factor = bodies.masses[other] * inverseCube;
+    const double otherFactor = mass * inverseCube;
+    sums[0] += distanceX * factor;
+    sums[1] += distanceY * factor;
+    sums[2] += distanceZ * factor;
+    accelerations[0][other] -= distanceX * otherFactor;
+    accelerations[1][other] -= distanceY * otherFactor;
+    accelerations[2][other] -= distanceZ * otherFactor;
+  }
+}
+
+#ifdef FORCE_KERNEL_X86
+// Four sources per iteration using 256-bit registers
+__attribute__((target("avx2,fma")))
+static void accumulateAvx2(const ForceSources& sources, double x, double y,
+    double z, double* accelerations) {
+  const __m256d targetX = _mm256_set1_pd(x);
+  const __m256d targetY = _mm256_set1_pd(y);
+  const __m256d targetZ = _mm256_set1_pd(z);
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d one = _mm256_set1_pd(1.0);
+  __m256d sumX = zero, sumY = zero, sumZ = zero;
+  size_t index = 0;
+  for (; index + 4 <= sources.count; index += 4) {
+    const __m256d distanceX = _mm256_sub_pd(
+      _mm256_loadu_pd(sources.positionsX + index), targetX);
+    const __m256d distanceY = _mm256_sub_pd(
+      _mm256_loadu_pd(sources.positionsY + index), targetY);
+    const __m256d distanceZ = _mm256_sub_pd(
+      _mm256_loadu_pd(sources.positionsZ + index), targetZ);
+    __m256d squared = _mm256_mul_pd(distanceX, distanceX);
+    squared = _mm256_fmadd_pd(distanceY, distanceY, squared);
+    squared = _mm256_fmadd_pd(distanceZ, distanceZ, squared);
+    // Lanes at distance zero (the target itself) must contribute nothing
+    const __m256d valid = _mm256_cmp_pd(squared, zero, _CMP_GT_OQ);
+    const __m256d inverseCube = _mm256_and_pd(valid, _mm256_div_pd(one,
+      _mm256_mul_pd(squared, _mm256_sqrt_pd(squared))));
+    const __m256d factor = _mm256_mul_pd(
+      _mm256_loadu_pd(sources.masses + index), inverseCube);
+    sumX = _mm256_fmadd_pd(distanceX, factor, sumX);
+    sumY = _mm256_fmadd_pd(distanceY, factor, sumY);
+    sumZ = _mm256_fmadd_pd(distanceZ, factor, sumZ);
+  }
+  // Horizontal sums of the lanes
+  alignas(32) double lanes[4];
+  _mm256_store_pd(lanes, sumX);
+  accelerations[0] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  _mm256_store_pd(lanes, sumY);
+  accelerations[1] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  _mm256_store_pd(lanes, sumZ);
+  accelerations[2] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  accumulateScalar(sources, index, x, y, z, accelerations);
+}
+
+// Eight sources per iteration using 512-bit registers
+__attribute__((target("avx512f")))
+static void accumulateAvx512(const ForceSources& sources, double x, double y,
+    double z, double* accelerations) {
+  const __m512d targetX = _mm512_set1_pd(x);
+  const __m512d targetY = _mm512_set1_pd(y);
+  const __m512d targetZ = _mm512_set1_pd(z);
+  const __m512d zero = _mm512_setzero_pd();
+  const __m512d one = _mm512_set1_pd(1.0);
+  __m512d sumX = zero, sumY = zero, sumZ = zero;
+  size_t index = 0;
+  for (; index + 8 <= sources.count; index += 8) {
+    const __m512d distanceX = _mm512_sub_pd(
+      _mm512_loadu_pd(sources.positionsX + index), targetX);
+    const __m512d distanceY = _mm512_sub_pd(
+      _mm512_loadu_pd(sources.positionsY + index), targetY);
+    const __m512d distanceZ = _mm512_sub_pd(
+      _mm512_loadu_pd(sources.positionsZ + index), targetZ);
+    __m512d squared = _mm512_mul_pd(distanceX, distanceX);
+    squared = _mm512_fmadd_pd(distanceY, distanceY, squared);
+    squared = _mm512_fmadd_pd(distanceZ, distanceZ, squared);
+    // Lanes at distance zero (the target itself) must contribute nothing
+    const __mmask8 valid = _mm512_cmp_pd_mask(squared, zero, _CMP_GT_OQ);
+    const __m512d inverseCube = _mm512_maskz_div_pd(valid, one,
+      _mm512_mul_pd(squared, _mm512_sqrt_pd(squared)));
+    const __m512d factor = _mm512_mul_pd(
+      _mm512_loadu_pd(sources.masses + index), inverseCube);
+    sumX = _mm512_fmadd_pd(distanceX, factor, sumX);
+    sumY = _mm512_fmadd_pd(distanceY, factor, sumY);
+    sumZ = _mm512_fmadd_pd(distanceZ, factor, sumZ);
+  }
+  accelerations[0] += _mm512_reduce_add_pd(sumX);
+  accelerations[1] += _mm512_reduce_add_pd(sumY);
+  accelerations[2] += _mm512_reduce_add_pd(sumZ);
+  accumulateScalar(sources, index, x, y, z, accelerations);
+}
+
+// Four pairs per iteration using 256-bit registers
+__attribute__((target("avx2,fma")))
+static void accumulatePairsAvx2(const ForceSources& bodies, size_t index,
+    size_t start, size_t end, double* const accelerations[],
+    double sums[]) {
+  const __m256d targetX = _mm256_set1_pd(bodies.positionsX[index]);
+  const __m256d targetY = _mm256_set1_pd(bodies.positionsY[index]);
+  const __m256d targetZ = _mm256_set1_pd(bodies.positionsZ[index]);
+  const __m256d mass = _mm256_set1_pd(bodies.masses[index]);
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d one = _mm256_set1_pd(1.0);
+  __m256d sumX = zero, sumY = zero, sumZ = zero;
+  size_t other = start;
+  for (; other + 4 <= end; other += 4) {
+    const __m256d distanceX = _mm256_sub_pd(
+      _mm256_loadu_pd(bodies.positionsX + other), targetX);
+    const __m256d distanceY = _mm256_sub_pd(
+      _mm256_loadu_pd(bodies.positionsY + other), targetY);
+    const __m256d distanceZ = _mm256_sub_pd(
+      _mm256_loadu_pd(bodies.positionsZ + other), targetZ);
+    __m256d squared = _mm256_mul_pd(distanceX, distanceX);
+    squared = _mm256_fmadd_pd(distanceY, distanceY, squared);
+    squared = _mm256_fmadd_pd(distanceZ, distanceZ, squared);
+    const __m256d valid = _mm256_cmp_pd(squared, zero, _CMP_GT_OQ);
+    const __m256d inverseCube = _mm256_and_pd(valid, _mm256_div_pd(one,
+      _mm256_mul_pd(squared, _mm256_sqrt_pd(squared))));
+    const __m256d factor = _mm256_mul_pd(
+      _mm256_loadu_pd(bodies.masses + other), inverseCube);
+    const __m256d otherFactor = _mm256_mul_pd(mass, inverseCube);
+    sumX = _mm256_fmadd_pd(distanceX, factor, sumX);
+    sumY = _mm256_fmadd_pd(distanceY, factor, sumY);
+    sumZ = _mm256_fmadd_pd(distanceZ, factor, sumZ);
+    _mm256_storeu_pd(accelerations[0] + other, _mm256_fnmadd_pd(distanceX,
+      otherFactor, _mm256_loadu_pd(accelerations[0] + other)));
+    _mm256_storeu_pd(accelerations[1] + other, _mm256_fnmadd_pd(distanceY,
+      otherFactor, _mm256_loadu_pd(accelerations[1] + other)));
+    _mm256_storeu_pd(accelerations[2] + other, _mm256_fnmadd_pd(distanceZ,
+      otherFactor, _mm256_loadu_pd(accelerations[2] + other)));
+  }
+  // Horizontal sums of the lanes
+  alignas(32) double lanes[4];
+  _mm256_store_pd(lanes, sumX);
+  sums[0] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  _mm256_store_pd(lanes, sumY);
+  sums[1] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  _mm256_store_pd(lanes, sumZ);
+  sums[2] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  accumulatePairsScalar(bodies, index, other, end, accelerations, sums);
+}
+
+// Eight pairs per iteration using 512-bit registers
+__attribute__((target("avx512f")))
+static void accumulatePairsAvx512(const ForceSources& bodies, size_t index,
+    size_t start, size_t end, double* const accelerations[],
+    double sums[]) {
+  const __m512d targetX = _mm512_set1_pd(bodies.positionsX[index]);
+  const __m512d targetY = _mm512_set1_pd(bodies.positionsY[index]);
+  const __m512d targetZ = _mm512_set1_pd(bodies.positionsZ[index]);
+  const __m512d mass = _mm512_set1_pd(bodies.masses[index]);
+  const __m512d zero = _mm512_setzero_pd();
+  const __m512d one = _mm512_set1_pd(1.0);
+  __m512d sumX = zero, sumY = zero, sumZ = zero;
+  size_t other = start;
+  for (; other + 8 <= end; other += 8) {
+    const __m512d distanceX = _mm512_sub_pd(
+      _mm512_loadu_pd(bodies.positionsX + other), targetX);
+    const __m512d distanceY = _mm512_sub_pd(
+      _mm512_loadu_pd(bodies.positionsY + other), targetY);
+    const __m512d distanceZ = _mm512_sub_pd(
+      _mm512_loadu_pd(bodies.positionsZ + other), targetZ);
+    __m512d squared = _mm512_mul_pd(distanceX, distanceX);
+    squared = _mm512_fmadd_pd(distanceY, distanceY, squared);
+    squared = _mm512_fmadd_pd(distanceZ, distanceZ, squared);
+    const __mmask8 valid = _mm512_cmp_pd_mask(squared, zero, _CMP_GT_OQ);
+    const __m512d inverseCube = _mm512_maskz_div_pd(valid, one,
+      _mm512_mul_pd(squared, _mm512_sqrt_pd(squared)));
+    const __m512d factor = _mm512_mul_pd(
+      _mm512_loadu_pd(bodies.masses + other), inverseCube);
+    const __m512d otherFactor = _mm512_mul_pd(mass, inverseCube);
+    sumX = _mm512_fmadd_pd(distanceX, factor, sumX);
+    sumY = _mm512_fmadd_pd(distanceY, factor, sumY);
+    sumZ = _mm512_fmadd_pd(distanceZ, factor, sumZ);
+    _mm512_storeu_pd(accelerations[0] + other, _mm512_fnmadd_pd(distanceX,
+      otherFactor, _mm512_loadu_pd(accelerations[0] + other)));
+    _mm512_storeu_pd(accelerations[1] + other, _mm512_fnmadd_pd(distanceY,
+      otherFactor, _mm512_loadu_pd(accelerations[1] + other)));
+    _mm512_storeu_pd(accelerations[2] + other, _mm512_fnmadd_pd(distanceZ,
+      otherFactor, _mm512_loadu_pd(accelerations[2] + other)));
+  }
+  sums[0] += _mm512_reduce_add_pd(sumX);
+  sums[1] += _mm512_reduce_add_pd(sumY);
+  sums[2] += _mm512_reduce_add_pd(sumZ);
+  accumulatePairsScalar(bodies, index, other, end, accelerations, sums);
+}
+
+// Widens four single precision lanes and adds their pull to the sums
+__attribute__((target("avx2,fma")))
+static inline void sumFloatLanesAvx2(__m128 distanceX, __m128 distanceY,
+    __m128 distanceZ, __m128 masses, __m128 inverse, __m256d& sumX,
+    __m256d& sumY, __m256d& sumZ) {
+  const __m256d inverseWide = _mm256_cvtps_pd(inverse);
+  const __m256d factor = _mm256_mul_pd(_mm256_cvtps_pd(masses),
+    _mm256_mul_pd(_mm256_mul_pd(inverseWide, inverseWide), inverseWide));
+  sumX = _mm256_fmadd_pd(_mm256_cvtps_pd(distanceX), factor, sumX);
+  sumY = _mm256_fmadd_pd(_mm256_cvtps_pd(distanceY), factor, sumY);
+  sumZ = _mm256_fmadd_pd(_mm256_cvtps_pd(distanceZ), factor, sumZ);
+}
+
+// Eight single precision sources per iteration using 256-bit registers
+__attribute__((target("avx2,fma")))
+static void accumulateFloatAvx2(const FloatForceSources& sources, float x,
+    float y, float z, double* accelerations) {
+  const __m256 targetX = _mm256_set1_ps(x);
+  const __m256 targetY = _mm256_set1_ps(y);
+  const __m256 targetZ = _mm256_set1_ps(z);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1.0f);
+  __m256d sumX = _mm256_setzero_pd(), sumY = sumX, sumZ = sumX;
+  size_t index = 0;
+  for (; index + 8 <= sources.count; index += 8) {
+    const __m256 distanceX = _mm256_sub_ps(
+      _mm256_loadu_ps(sources.positionsX + index), targetX);
+    const __m256 distanceY = _mm256_sub_ps(
+      _mm256_loadu_ps(sources.positionsY + index), targetY);
+    const __m256 distanceZ = _mm256_sub_ps(
+      _mm256_loadu_ps(sources.positionsZ + index), targetZ);
+    __m256 squared = _mm256_mul_ps(distanceX, distanceX);
+    squared = _mm256_fmadd_ps(distanceY, distanceY, squared);
+    squared = _mm256_fmadd_ps(distanceZ, distanceZ, squared);
+    // Lanes at distance zero (the target itself) must contribute nothing
+    const __m256 valid = _mm256_cmp_ps(squared, zero, _CMP_GT_OQ);
+    const __m256 inverse = _mm256_and_ps(valid, _mm256_div_ps(one,
+      _mm256_sqrt_ps(squared)));
+    const __m256 masses = _mm256_loadu_ps(sources.masses + index);
+    sumFloatLanesAvx2(_mm256_castps256_ps128(distanceX),
+      _mm256_castps256_ps128(distanceY), _mm256_castps256_ps128(distanceZ),
+      _mm256_castps256_ps128(masses), _mm256_castps256_ps128(inverse), sumX,
+      sumY, sumZ);
+    sumFloatLanesAvx2(_mm256_extractf128_ps(distanceX, 1),
+      _mm256_extractf128_ps(distanceY, 1), _mm256_extractf128_ps(distanceZ, 1),
+      _mm256_extractf128_ps(masses, 1), _mm256_extractf128_ps(inverse, 1),
+      sumX, sumY, sumZ);
+  }
+  // Horizontal sums of the lanes
+  alignas(32) double lanes[4];
+  _mm256_store_pd(lanes, sumX);
+  accelerations[0] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  _mm256_store_pd(lanes, sumY);
+  accelerations[1] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  _mm256_store_pd(lanes, sumZ);
+  accelerations[2] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  accumulateFloatScalar(sources, index, x, y, z, accelerations);
+}
+
+// Widens eight single precision lanes and adds their pull to the sums
+__attribute__((target("avx512f")))
+static inline void sumFloatLanesAvx512(__m256 distanceX, __m256 distanceY,
+    __m256 distanceZ, __m256 masses, __m256 inverse, __m512d& sumX,
+    __m512d& sumY, __m512d& sumZ) {
+  const __m512d inverseWide = _mm512_cvtps_pd(inverse);
+  const __m512d factor = _mm512_mul_pd(_mm512_cvtps_pd(masses),
+    _mm512_mul_pd(_mm512_mul_pd(inverseWide, inverseWide), inverseWide));
+  sumX = _mm512_fmadd_pd(_mm512_cvtps_pd(distanceX), factor, sumX);
+  sumY = _mm512_fmadd_pd(_mm512_cvtps_pd(distanceY), factor, sumY);
+  sumZ = _mm512_fmadd_pd(_mm512_cvtps_pd(distanceZ), factor, sumZ);
+}
+
+// Lower or upper eight lanes of a single precision register
+__attribute__((target("avx512f")))
+static inline __m256 getHalf(__m512 values, int upper) {
+  return _mm256_castpd_ps(upper ?
+    _mm512_extractf64x4_pd(_mm512_castps_pd(values), 1) :
+    _mm512_castpd512_pd256(_mm512_castps_pd(values)));
+}
+
+// Sixteen single precision sources per iteration using 512-bit registers
+__attribute__((target("avx512f")))
+static void accumulateFloatAvx512(const FloatForceSources& sources, float x,
+    float y, float z, double* accelerations) {
+  const __m512 targetX = _mm512_set1_ps(x);
+  const __m512 targetY = _mm512_set1_ps(y);
+  const __m512 targetZ = _mm512_set1_ps(z);
+  const __m512 zero = _mm512_setzero_ps();
+  const __m512 one = _mm512_set1_ps(1.0f);
+  __m512d sumX = _mm512_setzero_pd(), sumY = sumX, sumZ = sumX;
+  size_t index = 0;
+  for (; index + 16 <= sources.count; index += 16) {
+    const __m512 distanceX = _mm512_sub_ps(
+      _mm512_loadu_ps(sources.positionsX + index), targetX);
+    const __m512 distanceY = _mm512_sub_ps(
+      _mm512_loadu_ps(sources.positionsY + index), targetY);
+    const __m512 distanceZ = _mm512_sub_ps(
+      _mm512_loadu_ps(sources.positionsZ + index), targetZ);
+    __m512 squared = _mm512_mul_ps(distanceX, distanceX);
+    squared = _mm512_fmadd_ps(distanceY, distanceY, squared);
+    squared = _mm512_fmadd_ps(distanceZ, distanceZ, squared);
+    // Lanes at distance zero (the target itself) must contribute nothing
+    const __mmask16 valid = _mm512_cmp_ps_mask(squared, zero, _CMP_GT_OQ);
+    const __m512 inverse = _mm512_maskz_div_ps(valid, one,
+      _mm512_sqrt_ps(squared));
+    const __m512 masses = _mm512_loadu_ps(sources.masses + index);
+    for (int upper = 0; upper < 2; ++upper) {
+      sumFloatLanesAvx512(getHalf(distanceX, upper),
+        getHalf(distanceY, upper), getHalf(distanceZ, upper),
+        getHalf(masses, upper), getHalf(inverse, upper), sumX, sumY, sumZ);
+    }
+  }
+  accelerations[0] += _mm512_reduce_add_pd(sumX);
+  accelerations[1] += _mm512_reduce_add_pd(sumY);
+  accelerations[2] += _mm512_reduce_add_pd(sumZ);
+  accumulateFloatScalar(sources, index, x, y, z, accelerations);
+}
+#endif  // FORCE_KERNEL_X86
+
+// Queries the processor once for the widest supported instruction set
+static ForceKernel::Isa detectIsa() {
+#ifdef FORCE_KERNEL_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return ForceKernel::ISA_AVX512;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return ForceKernel::ISA_AVX2;
+  }
+#endif
+  return ForceKernel::ISA_SCALAR;
+}
+
+ForceKernel::Isa ForceKernel::getIsa() {
+  static const Isa isa = detectIsa();
+  return isa;
+}
+
+const char* ForceKernel::getIsaName(Isa isa) {
+  switch (isa) {
+    case ISA_AVX512: return "avx512";
+    case ISA_AVX2: return "avx2";
+    default: return "scalar";
+  }
+}
+
+void ForceKernel::accumulate(const ForceSources& sources, double x, double y,
+    double z, double* accelerations) {
+  switch (ForceKernel::getIsa()) {
+#ifdef FORCE_KERNEL_X86
+    case ISA_AVX512:
+      accumulateAvx512(sources, x, y, z, accelerations);
+      break;
+    case ISA_AVX2:
+      accumulateAvx2(sources, x, y, z, accelerations);
+      break;
+#endif
+    default:
+      accumulateScalar(sources, 0, x, y, z, accelerations);
+  }
+}
+
+void ForceKernel::accumulate(const FloatForceSources& sources, float x,
+    float y, float z, double* accelerations) {
+  switch (ForceKernel::getIsa()) {
+#ifdef FORCE_KERNEL_X86
+    case ISA_AVX512:
+      accumulateFloatAvx512(sources, x, y, z, accelerations);
+      break;
+    case ISA_AVX2:
+      accumulateFloatAvx2(sources, x, y, z, accelerations);
+      break;
+#endif
+    default:
+      accumulateFloatScalar(sources, 0, x, y, z, accelerations);
+  }
+}
+
+void ForceKernel::accumulateSymmetric(const ForceSources& bodies,
+    size_t firstBegin, size_t firstEnd, size_t secondBegin, size_t secondEnd,
+    double* accelerationsX, double* accelerationsY, double* accelerationsZ) {
+  double* const accelerations[] = {accelerationsX, accelerationsY,
+    accelerationsZ};
+  const Isa isa = ForceKernel::getIsa();
+  for (size_t index = firstBegin; index < firstEnd; ++index) {
+    // Inside a block, pairs before the body were evaluated by earlier ones
+    const size_t start = firstBegin == secondBegin ? index + 1 : secondBegin;
+    double sums[] = {0.0, 0.0, 0.0};
+    switch (isa) {
+#ifdef FORCE_KERNEL_X86
+      case ISA_AVX512:
+        accumulatePairsAvx512(bodies, index, start, secondEnd, accelerations,
+          sums);
+        break;
+      case ISA_AVX2:
+        accumulatePairsAvx2(bodies, index, start, secondEnd, accelerations,
+          sums);
+        break;
+#endif
+      default:
+        accumulatePairsScalar(bodies, index, start, secondEnd, accelerations,
+          sums);
+    }
+    accelerationsX[index] += sums[0];
+    accelerationsY[index] += sums[1];
+    accelerationsZ[index] += sums[2];
+  }
+}
+
+void ForceSourceBuffer::deserialize(
+    const std::vector<double>& serializedBodies) {
+  const size_t count = serializedBodies.size() / BODY_ACCELERATION_DATA_SIZE;
+  this->masses.resize(count);
+  this->positionsX.resize(count);
+  this->positionsY.resize(count);
+  this->positionsZ.resize(count);
+  for (size_t index = 0; index < count; ++index) {
+    const size_t offset = index * BODY_ACCELERATION_DATA_SIZE;
+    this->masses[index] = serializedBodies[offset + ACCELERATION_MASS];
+    this->positionsX[index] =
+      serializedBodies[offset + ACCELERATION_POSITION_X];
+    this->positionsY[index] =
+      serializedBodies[offset + ACCELERATION_POSITION_Y];
+    this->positionsZ[index] =
+      serializedBodies[offset + ACCELERATION_POSITION_Z];
+  }
+}
+
+void ForceSourceBuffer::append(double mass, double x, double y, double z) {
+  this->masses.push_back(mass);
+  this->positionsX.push_back(x);
+  this->positionsY.push_back(y);
+  this->positionsZ.push_back(z);
+}
+
+ForceSources ForceSourceBuffer::getSources() const {
+  ForceSources sources;
+  sources.masses = this->masses.data();
+  sources.positionsX = this->positionsX.data();
+  sources.positionsY = this->positionsY.data();
+  sources.positionsZ = this->positionsZ.data();
+  sources.count = this->masses.size();
+  return sources;
+}
+
+void FloatForceSourceBuffer::deserialize(
+    const std::vector<float>& serializedBodies) {
+  const size_t count = serializedBodies.size() / BODY_ACCELERATION_DATA_SIZE;
+  this->resize(count);
+  for (size_t index = 0; index < count; ++index) {
+    const size_t offset = index * BODY_ACCELERATION_DATA_SIZE;
+    this->masses[index] = serializedBodies[offset + ACCELERATION_MASS];
+    this->positionsX[index] =
+      serializedBodies[offset + ACCELERATION_POSITION_X];
+    this->positionsY[index] =
+      serializedBodies[offset + ACCELERATION_POSITION_Y];
+    this->positionsZ[index] =
+      serializedBodies[offset + ACCELERATION_POSITION_Z];
+  }
+}
+
+void FloatForceSourceBuffer::resize(size_t count) {
+  this->masses.resize(count);
+  this->positionsX.resize(count);
+  this->positionsY.resize(count);
+  this->positionsZ.resize(count);
+}
+
+FloatForceSources FloatForceSourceBuffer::getSources() const {
+  FloatForceSources sources;
+  sources.masses = this->masses.data();
+  sources.positionsX = this->positionsX.data();
+  sources.positionsY = this->positionsY.data();
+  sources.positionsZ = this->positionsZ.data();
+  sources.count = this->masses.size();
+  return sources;
+}
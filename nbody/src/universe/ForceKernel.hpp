@@ -0,0 +1,160 @@
+// Copyright 2025 Stockholm Syndrome. Universidad de Costa Rica. CC BY 4.0
+
+#ifndef FORCEKERNEL_HPP
+#define FORCEKERNEL_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include "common.hpp"
+
+/// @brief Contiguous arrays describing bodies that pull on others
+/// @details Sources with zero mass contribute nothing, so inactive bodies can
+/// be masked by zeroing their mass instead of branching inside the kernel
+struct ForceSources {
+  /// Masses of the sources
+  const double* masses = nullptr;
+  /// Position components of the sources
+  const double* positionsX = nullptr;
+  const double* positionsY = nullptr;
+  const double* positionsZ = nullptr;
+  /// Number of sources in the arrays
+  size_t count = 0;
+
+  /// @brief Get a view of the sources in [begin, end[
+  ForceSources slice(size_t begin, size_t end) const {
+    ForceSources sources;
+    sources.masses = this->masses + begin;
+    sources.positionsX = this->positionsX + begin;
+    sources.positionsY = this->positionsY + begin;
+    sources.positionsZ = this->positionsZ + begin;
+    sources.count = end - begin;
+    return sources;
+  }
+};
+
+/// @brief Owning arrays of force sources, e.g. bodies received from others
+struct ForceSourceBuffer {
+  /// Masses of the sources
+  std::vector<double> masses;
+  /// Position components of the sources
+  std::vector<double> positionsX;
+  std::vector<double> positionsY;
+  std::vector<double> positionsZ;
+
+  /// @brief Scatter serialized acceleration data into the arrays
+  /// @param serializedBodies Masses and positions, see AccelerationData
+  void deserialize(const std::vector<double>& serializedBodies);
+
+  /// @brief Add one source at the end of the arrays
+  void append(double mass, double x, double y, double z);
+
+  /// @brief Get a non-owning view of the arrays for the kernel
+  ForceSources getSources() const;
+};
+
+/// @brief Single precision force sources, see ForceSources
+struct FloatForceSources {
+  /// Masses of the sources
+  const float* masses = nullptr;
+  /// Position components of the sources
+  const float* positionsX = nullptr;
+  const float* positionsY = nullptr;
+  const float* positionsZ = nullptr;
+  /// Number of sources in the arrays
+  size_t count = 0;
+
+  /// @brief Get a view of the sources in [begin, end[
+  FloatForceSources slice(size_t begin, size_t end) const {
+    FloatForceSources sources;
+    sources.masses = this->masses + begin;
+    sources.positionsX = this->positionsX + begin;
+    sources.positionsY = this->positionsY + begin;
+    sources.positionsZ = this->positionsZ + begin;
+    sources.count = end - begin;
+    return sources;
+  }
+};
+
+/// @brief Owning arrays of single precision force sources
+struct FloatForceSourceBuffer {
+  /// Masses of the sources
+  std::vector<float> masses;
+  /// Position components of the sources
+  std::vector<float> positionsX;
+  std::vector<float> positionsY;
+  std::vector<float> positionsZ;
+
+  /// @brief Scatter serialized acceleration data into the arrays
+  /// @param serializedBodies Masses and positions, see AccelerationData
+  void deserialize(const std::vector<float>& serializedBodies);
+
+  /// @brief Resize the arrays, to be filled with set
+  void resize(size_t count);
+
+  /// @brief Store a source rounded to single precision
+  void set(size_t index, double mass, double x, double y, double z) {
+    this->masses[index] = static_cast<float>(mass);
+    this->positionsX[index] = static_cast<float>(x);
+    this->positionsY[index] = static_cast<float>(y);
+    this->positionsZ[index] = static_cast<float>(z);
+  }
+
+  /// @brief Get a non-owning view of the arrays for the kernel
+  FloatForceSources getSources() const;
+};
+
+/// @brief Batched gravitational acceleration kernel
+/// @details Computes sum(m_j * r_j / |r_j|^3) for one target against many
+/// sources, processing 4 (AVX2) or 8 (AVX-512) sources per iteration. The
+/// instruction set is chosen at runtime, with a scalar fallback. Sources at
+/// distance zero, including the target itself, are skipped.
+class ForceKernel {
+  DISABLE_COPY(ForceKernel);
+  ForceKernel() = delete;
+  ~ForceKernel() = delete;
+
+ public:
+  /// Instruction sets the kernel can run with
+  enum Isa {
+    ISA_SCALAR, ISA_AVX2, ISA_AVX512
+  };
+
+ public:
+  /// @brief Add the pull of all sources to the acceleration of a target
+  /// @param sources Bodies pulling on the target
+  /// @param x,y,z Position of the target
+  /// @param accelerations Array of DIM components where the sum is added
+  static void accumulate(const ForceSources& sources, double x, double y,
+    double z, double* accelerations);
+
+  /// @brief Add the pull of single precision sources to the acceleration of
+  /// a target. Distances and square roots are computed in single precision,
+  /// twice as many per instruction, and the products are summed in double
+  /// precision
+  /// @see accumulate
+  static void accumulate(const FloatForceSources& sources, float x, float y,
+    float z, double* accelerations);
+
+  /// @brief Add the pull between the bodies of two blocks, evaluating each
+  /// unordered pair once and applying it to both bodies with opposite signs
+  /// @details Blocks are ranges [begin, end[ of the same arrays. If both
+  /// ranges are the same block, only pairs inside it are evaluated. Callers
+  /// must ensure no other thread writes the accelerations of either block
+  /// @param bodies Masses and positions of all bodies
+  /// @param firstBegin,firstEnd Range of the first block
+  /// @param secondBegin,secondEnd Range of the second block
+  /// @param accelerationsX,accelerationsY,accelerationsZ Arrays parallel to
+  /// bodies where the contributions are added
+  static void accumulateSymmetric(const ForceSources& bodies,
+    size_t firstBegin, size_t firstEnd, size_t secondBegin, size_t secondEnd,
+    double* accelerationsX, double* accelerationsY, double* accelerationsZ);
+
+  /// @brief Get the instruction set detected for this processor
+  static Isa getIsa();
+
+  /// @brief Get a printable name of an instruction set
+  static const char* getIsaName(Isa isa);
+};
+
+#endif  // FORCEKERNEL_HPP
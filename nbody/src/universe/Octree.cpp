@@ -0,0 +1,204 @@
+// Copyright 2025 Stockholm Syndrome. Universidad de Costa Rica. CC BY 4.0
+
+#include "Octree.hpp"
+
+#include <omp.h>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <utility>
+
+// Index of the sub-cube of node where a position falls: bit 0 is set for the
+// upper half in x, bit 1 in y and bit 2 in z
+static inline int getOctant(double centerX, double centerY, double centerZ,
+    double x, double y, double z) {
+  return (x >= centerX) | (y >= centerY) << 1 | (z >= centerZ) << 2;
+}
+
+Octree::Octree(double theta)
+  : theta(theta) {
+}
+
+void Octree::build(const ForceSourceBuffer& sources) {
+  this->root.reset();
+  this->bodies = sources;
+  const size_t count = this->bodies.masses.size();
+  if (count == 0) {
+    return;
+  }
+  this->scratch.masses.resize(count);
+  this->scratch.positionsX.resize(count);
+  this->scratch.positionsY.resize(count);
+  this->scratch.positionsZ.resize(count);
+
+  // The root is the smallest cube enclosing every body
+  double minX = this->bodies.positionsX[0], maxX = minX;
+  double minY = this->bodies.positionsY[0], maxY = minY;
+  double minZ = this->bodies.positionsZ[0], maxZ = minZ;
+  for (size_t index = 1; index < count; ++index) {
+    minX = std::min(minX, this->bodies.positionsX[index]);
+    maxX = std::max(maxX, this->bodies.positionsX[index]);
+    minY = std::min(minY, this->bodies.positionsY[index]);
+    maxY = std::max(maxY, this->bodies.positionsY[index]);
+    minZ = std::min(minZ, this->bodies.positionsZ[index]);
+    maxZ = std::max(maxZ, this->bodies.positionsZ[index]);
+  }
+  this->root = std::make_unique<Node>();
+  this->root->centerX = (minX + maxX) / 2;
+  this->root->centerY = (minY + maxY) / 2;
+  this->root->centerZ = (minZ + maxZ) / 2;
+  this->root->halfWidth = std::max({maxX - minX, maxY - minY, maxZ - minZ,
+    1.0}) / 2;
+  this->root->begin = 0;
+  this->root->end = count;
+
+  if (omp_in_parallel()) {
+    this->buildNode(this->root.get(), 0);
+  } else {
+    // One thread walks the tree while the others take the spawned subtrees
+    #pragma omp parallel num_threads(omp_get_max_threads())
+    #pragma omp single
+    this->buildNode(this->root.get(), 0);
+  }
+}
+
+void Octree::buildNode(Node* node, int depth) {
+  // Mass center of the bodies in the node
+  double sumX = 0.0, sumY = 0.0, sumZ = 0.0;
+  for (size_t index = node->begin; index < node->end; ++index) {
+    const double mass = this->bodies.masses[index];
+    node->mass += mass;
+    sumX += mass * this->bodies.positionsX[index];
+    sumY += mass * this->bodies.positionsY[index];
+    sumZ += mass * this->bodies.positionsZ[index];
+  }
+  node->massCenterX = sumX / node->mass;
+  node->massCenterY = sumY / node->mass;
+  node->massCenterZ = sumZ / node->mass;
+
+  const size_t count = node->end - node->begin;
+  if (count <= OCTREE_LEAF_CAPACITY || depth >= OCTREE_MAX_DEPTH) {
+    return;  // Small enough to be summed directly
+  }
+  node->leaf = false;
+  size_t starts[9];
+  this->partition(node, starts);
+
+  const double quarterWidth = node->halfWidth / 2;
+  for (int octant = 0; octant < 8; ++octant) {
+    if (starts[octant] == starts[octant + 1]) {
+      continue;  // Empty sub-cube
+    }
+    std::unique_ptr<Node> child = std::make_unique<Node>();
+    child->centerX = node->centerX + (octant & 1 ? quarterWidth :
+      -quarterWidth);
+    child->centerY = node->centerY + (octant & 2 ? quarterWidth :
+      -quarterWidth);
+    child->centerZ = node->centerZ + (octant & 4 ? quarterWidth :
+      -quarterWidth);
+    child->halfWidth = quarterWidth;
+    child->begin = starts[octant];
+    child->end = starts[octant + 1];
+    Node* childNode = child.get();
+    node->children[octant] = std::move(child);
+    // Subtrees cover disjoint ranges of the arrays, so they can be built
+    // concurrently. Small ones are not worth a task
+    #pragma omp task firstprivate(childNode, depth) \
+      if(childNode->end - childNode->begin > OCTREE_TASK_THRESHOLD)
+    this->buildNode(childNode, depth + 1);
+  }
+  #pragma omp taskwait
+}
+
+void Octree::partition(Node* node, size_t starts[9]) {
+  // Count the bodies that fall in each octant
+  size_t counts[8] = {0};
+  for (size_t index = node->begin; index < node->end; ++index) {
+    ++counts[getOctant(node->centerX, node->centerY, node->centerZ,
+      this->bodies.positionsX[index], this->bodies.positionsY[index],
+      this->bodies.positionsZ[index])];
+  }
+  starts[0] = node->begin;
+  size_t nexts[8];
+  for (int octant = 0; octant < 8; ++octant) {
+    nexts[octant] = starts[octant];
+    starts[octant + 1] = starts[octant] + counts[octant];
+  }
+  // Scatter the bodies into their octant's range, then copy them back
+  for (size_t index = node->begin; index < node->end; ++index) {
+    const int octant = getOctant(node->centerX, node->centerY,
+      node->centerZ, this->bodies.positionsX[index],
+      this->bodies.positionsY[index], this->bodies.positionsZ[index]);
+    const size_t target = nexts[octant]++;
+    this->scratch.masses[target] = this->bodies.masses[index];
+    this->scratch.positionsX[target] = this->bodies.positionsX[index];
+    this->scratch.positionsY[target] = this->bodies.positionsY[index];
+    this->scratch.positionsZ[target] = this->bodies.positionsZ[index];
+  }
+  const size_t begin = node->begin, end = node->end;
+  std::copy(this->scratch.masses.begin() + begin,
+    this->scratch.masses.begin() + end, this->bodies.masses.begin() + begin);
+  std::copy(this->scratch.positionsX.begin() + begin,
+    this->scratch.positionsX.begin() + end,
+    this->bodies.positionsX.begin() + begin);
+  std::copy(this->scratch.positionsY.begin() + begin,
+    this->scratch.positionsY.begin() + end,
+    this->bodies.positionsY.begin() + begin);
+  std::copy(this->scratch.positionsZ.begin() + begin,
+    this->scratch.positionsZ.begin() + end,
+    this->bodies.positionsZ.begin() + begin);
+}
+
+ForceSources Octree::getSources(const Node* node) const {
+  ForceSources sources;
+  sources.masses = this->bodies.masses.data() + node->begin;
+  sources.positionsX = this->bodies.positionsX.data() + node->begin;
+  sources.positionsY = this->bodies.positionsY.data() + node->begin;
+  sources.positionsZ = this->bodies.positionsZ.data() + node->begin;
+  sources.count = node->end - node->begin;
+  return sources;
+}
+
+void Octree::accumulate(double x, double y, double z,
+    double* accelerations) const {
+  if (!this->root) {
+    return;
+  }
+  // Each visited node pushes at most 8 children, so the stack is bounded
+  const Node* pending[8 * OCTREE_MAX_DEPTH + 1];
+  size_t pendingCount = 0;
+  pending[pendingCount++] = this->root.get();
+  const double thetaSquared = this->theta * this->theta;
+  while (pendingCount > 0) {
+    const Node* node = pending[--pendingCount];
+    if (node->leaf) {
+      ForceKernel::accumulate(this->getSources(node), x, y, z,
+        accelerations);
+      continue;
+    }
+    const double distanceX = node->massCenterX - x;
+    const double distanceY = node->massCenterY - y;
+    const double distanceZ = node->massCenterZ - z;
+    const double squared = distanceX * distanceX + distanceY * distanceY +
+      distanceZ * distanceZ;
+    const double width = 2 * node->halfWidth;
+    // A node holding the position may hold the body itself, whose mass must
+    // not pull on it. Below theta 1/sqrt(3) such nodes never look far
+    const bool contains = std::fabs(x - node->centerX) <= node->halfWidth &&
+      std::fabs(y - node->centerY) <= node->halfWidth &&
+      std::fabs(z - node->centerZ) <= node->halfWidth;
+    if (!contains && width * width < thetaSquared * squared) {
+      // Far enough: the whole node pulls as a single body
+      const double factor = node->mass / (squared * std::sqrt(squared));
+      accelerations[0] += distanceX * factor;
+      accelerations[1] += distanceY * factor;
+      accelerations[2] += distanceZ * factor;
+    } else {
+      for (const std::unique_ptr<Node>& child : node->children) {
+        if (child) {
+          pending[pendingCount++] = child.get();
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,93 @@
+// Copyright 2025 Stockholm Syndrome. Universidad de Costa Rica. CC BY 4.0
+
+#ifndef OCTREE_HPP
+#define OCTREE_HPP
+
+#include <memory>
+#include <vector>
+
+#include "common.hpp"
+#include "ForceKernel.hpp"
+
+/// Maximum number of bodies kept in a leaf before it is subdivided
+#define OCTREE_LEAF_CAPACITY 8
+/// Maximum depth of the tree, guards against coincident bodies
+#define OCTREE_MAX_DEPTH 48
+/// Minimum amount of bodies in a node to build its children as a task
+#define OCTREE_TASK_THRESHOLD 4096
+
+/// @brief Barnes-Hut octree to approximate gravitational accelerations
+/// @details Bodies are reordered so that every node covers a contiguous range
+/// of the arrays. Leaves are summed directly with the ForceKernel, and far
+/// nodes are replaced by their center of mass when the ratio between the
+/// node's width and its distance is below the opening angle theta.
+class Octree {
+  DISABLE_COPY(Octree);
+
+ private:
+  /// @brief Cube of space and the bodies inside it
+  struct Node {
+    /// Total mass of the bodies in the node
+    double mass = 0.0;
+    /// Center of mass of the bodies in the node
+    double massCenterX = 0.0;
+    double massCenterY = 0.0;
+    double massCenterZ = 0.0;
+    /// Geometric center of the cube
+    double centerX = 0.0;
+    double centerY = 0.0;
+    double centerZ = 0.0;
+    /// Half of the cube's width
+    double halfWidth = 0.0;
+    /// Range of bodies in the reordered arrays [begin, end[
+    size_t begin = 0;
+    size_t end = 0;
+    /// True if the node has no children and its bodies are summed directly
+    bool leaf = true;
+    /// Sub-cubes, null if empty
+    std::unique_ptr<Node> children[8];
+  };
+
+ private:
+  /// Opening angle, zero computes exact accelerations
+  double theta = 0.0;
+  /// Bodies in the tree, reordered by node
+  ForceSourceBuffer bodies;
+  /// Auxiliary arrays used to partition bodies into octants
+  ForceSourceBuffer scratch;
+  /// Root of the tree, null if the tree is empty
+  std::unique_ptr<Node> root;
+
+ public:
+  /// @brief Constructor
+  /// @param theta Opening angle for the approximation
+  explicit Octree(double theta);
+  /// @brief Destructor
+  ~Octree() = default;
+
+  /// @brief Build the tree over the given bodies. Uses OpenMP tasks if called
+  /// outside a parallel region
+  /// @param sources Masses and positions of the bodies, all with mass > 0
+  void build(const ForceSourceBuffer& sources);
+
+  /// @brief Add the approximated pull of every body in the tree on a target
+  /// @param x,y,z Position of the target
+  /// @param accelerations Array of DIM components where the sum is added
+  void accumulate(double x, double y, double z, double* accelerations) const;
+
+ private:
+  /// @brief Compute the mass center of a node and split it into octants
+  /// @param node Node whose range, center and width are already set
+  /// @param depth Depth of the node in the tree
+  void buildNode(Node* node, int depth);
+
+  /// @brief Reorder the bodies of a node by octant
+  /// @param node Node to partition
+  /// @param starts Output, start of each octant's range
+  void partition(Node* node, size_t starts[9]);
+
+  /// @brief Get the sources of a node's range, to sum them directly
+  ForceSources getSources(const Node* node) const;
+};
+
+#endif  // OCTREE_HPP
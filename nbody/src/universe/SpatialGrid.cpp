@@ -0,0 +1,127 @@
+// Copyright 2025 Stockholm Syndrome. Universidad de Costa Rica. CC BY 4.0
+
+#include "SpatialGrid.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+// Cells are clamped to this coordinate, far beyond any realistic universe
+#define SPATIAL_GRID_MAX_CELL 1e15
+// Bodies over this many times the median radius are kept out of the cells
+#define SPATIAL_GRID_LARGE_FACTOR 4.0
+
+void SpatialGrid::build(const double* positionsX, const double* positionsY,
+    const double* positionsZ, const double* radiuses, size_t count,
+    const uint8_t* includes) {
+  this->indexes.clear();
+  this->largeIndexes.clear();
+  this->allIndexes.clear();
+  this->cells.clear();
+  for (size_t index = 0; index < count; ++index) {
+    if (!includes || includes[index]) {
+      this->allIndexes.push_back(index);
+    }
+  }
+  // A few huge bodies must not widen the cells of all the others
+  std::vector<double> sortedRadiuses;
+  sortedRadiuses.reserve(this->allIndexes.size());
+  for (const size_t index : this->allIndexes) {
+    sortedRadiuses.push_back(radiuses[index]);
+  }
+  double largeRadius = 0.0;
+  if (!sortedRadiuses.empty()) {
+    const auto median = sortedRadiuses.begin() + sortedRadiuses.size() / 2;
+    std::nth_element(sortedRadiuses.begin(), median, sortedRadiuses.end());
+    largeRadius = SPATIAL_GRID_LARGE_FACTOR * *median;
+  }
+  this->maxRadius = 0.0;
+  for (const size_t index : this->allIndexes) {
+    if (radiuses[index] > largeRadius) {
+      this->largeIndexes.push_back(index);
+    } else {
+      this->maxRadius = std::max(this->maxRadius, radiuses[index]);
+    }
+  }
+  // Colliding bodies are closer than the sum of their radiuses, so at most
+  // twice the largest radius apart. The margin keeps rounding from placing
+  // such bodies two cells apart
+  this->cellWidth = this->maxRadius > 0 ? 2 * this->maxRadius * (1 + 1e-6)
+    : 1.0;
+
+  // Sort bodies by cell key, then by index
+  std::vector<std::pair<uint64_t, size_t>> keyed;
+  keyed.reserve(this->allIndexes.size());
+  for (const size_t index : this->allIndexes) {
+    if (radiuses[index] <= largeRadius) {
+      keyed.emplace_back(SpatialGrid::getKey(this->getCell(positionsX[index]),
+        this->getCell(positionsY[index]), this->getCell(positionsZ[index])),
+        index);
+    }
+  }
+  std::sort(keyed.begin(), keyed.end());
+
+  // Each cell owns a contiguous range of the sorted indexes
+  this->indexes.resize(keyed.size());
+  for (size_t position = 0; position < keyed.size(); ++position) {
+    this->indexes[position] = keyed[position].second;
+    if (position == 0 || keyed[position].first != keyed[position - 1].first) {
+      this->cells[keyed[position].first] = {position, position + 1};
+    } else {
+      this->cells[keyed[position].first].second = position + 1;
+    }
+  }
+}
+
+void SpatialGrid::query(double x, double y, double z, double reach,
+    std::vector<size_t>& candidates) const {
+  candidates.clear();
+  // Bodies within reach are at most this amount of cells away in each axis
+  const double cellsAway = reach / this->cellWidth;
+  const int64_t span = cellsAway < 1e6 ?
+    static_cast<int64_t>(cellsAway) + 1 : 0;
+  const double stencilCells = std::pow(2.0 * span + 1, 3);
+  // Visiting more cells than occupied ones is slower than a full sweep
+  if (span == 0 || stencilCells > static_cast<double>(this->cells.size())) {
+    candidates = this->allIndexes;
+    return;
+  }
+
+  const int64_t cellX = this->getCell(x);
+  const int64_t cellY = this->getCell(y);
+  const int64_t cellZ = this->getCell(z);
+  for (int64_t offsetX = -span; offsetX <= span; ++offsetX) {
+    for (int64_t offsetY = -span; offsetY <= span; ++offsetY) {
+      for (int64_t offsetZ = -span; offsetZ <= span; ++offsetZ) {
+        const auto cell = this->cells.find(SpatialGrid::getKey(
+          cellX + offsetX, cellY + offsetY, cellZ + offsetZ));
+        if (cell != this->cells.end()) {
+          candidates.insert(candidates.end(),
+            this->indexes.begin() + cell->second.first,
+            this->indexes.begin() + cell->second.second);
+        }
+      }
+    }
+  }
+  // Large bodies may reach any position
+  candidates.insert(candidates.end(), this->largeIndexes.begin(),
+    this->largeIndexes.end());
+  // Different cells may share a key, so remove repeated bodies
+  std::sort(candidates.begin(), candidates.end());
+  candidates.erase(std::unique(candidates.begin(), candidates.end()),
+    candidates.end());
+}
+
+int64_t SpatialGrid::getCell(double coordinate) const {
+  const double cell = std::floor(coordinate / this->cellWidth);
+  return static_cast<int64_t>(std::min(SPATIAL_GRID_MAX_CELL,
+    std::max(-SPATIAL_GRID_MAX_CELL, cell)));
+}
+
+uint64_t SpatialGrid::getKey(int64_t cellX, int64_t cellY, int64_t cellZ) {
+  // Large primes spread neighbouring cells over the hash table
+  return static_cast<uint64_t>(cellX) * 73856093ULL ^
+    static_cast<uint64_t>(cellY) * 19349663ULL ^
+    static_cast<uint64_t>(cellZ) * 83492791ULL;
+}
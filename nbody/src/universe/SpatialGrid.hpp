@@ -0,0 +1,78 @@
+// Copyright 2025 Stockholm Syndrome. Universidad de Costa Rica. CC BY 4.0
+
+#ifndef SPATIALGRID_HPP
+#define SPATIALGRID_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "common.hpp"
+
+/// @brief Uniform grid of cubic cells hashed by their integer coordinates
+/// @details Used as broad phase for collision detection: only bodies in cells
+/// near a position are returned as candidates. The cell width is derived from
+/// the largest typical radius, up to SPATIAL_GRID_LARGE_FACTOR times the
+/// median, so a body must only look at its 27 neighbouring cells unless its
+/// own radius is larger. Bodies over that radius would make cells too wide
+/// for everyone else, so they are kept apart and returned by every query.
+class SpatialGrid {
+  DISABLE_COPY(SpatialGrid);
+
+ private:
+  /// Width of every cell
+  double cellWidth = 1.0;
+  /// Largest radius among the bodies in cells
+  double maxRadius = 0.0;
+  /// Indexes of the bodies in cells, grouped by cell, ascending in a cell
+  std::vector<size_t> indexes;
+  /// Ascending indexes of the bodies too large for the cells
+  std::vector<size_t> largeIndexes;
+  /// Ascending indexes of every body in the grid, returned when searching
+  /// the cells would visit more of them than there are occupied
+  std::vector<size_t> allIndexes;
+  /// Range of indexes [first, second[ that belong to each cell key
+  std::unordered_map<uint64_t, std::pair<size_t, size_t>> cells;
+
+ public:
+  /// @brief Constructor
+  SpatialGrid() = default;
+  /// @brief Destructor
+  ~SpatialGrid() = default;
+
+  /// @brief Place bodies in cells
+  /// @param positionsX,positionsY,positionsZ Position components of bodies
+  /// @param radiuses Radiuses of the bodies
+  /// @param count Number of bodies in the arrays
+  /// @param includes If not null, only bodies with a non-zero flag are added
+  void build(const double* positionsX, const double* positionsY,
+    const double* positionsZ, const double* radiuses, size_t count,
+    const uint8_t* includes = nullptr);
+
+  /// @brief Get the bodies that may be closer than reach to a position
+  /// @param x,y,z Position to search around
+  /// @param reach Largest distance of interest, e.g. the sum of the radius of
+  /// a body and getMaxRadius()
+  /// @param candidates Output, ascending indexes of nearby bodies. Contains
+  /// every body closer than reach and every body too large for the cells,
+  /// and possibly some farther ones
+  void query(double x, double y, double z, double reach,
+    std::vector<size_t>& candidates) const;
+
+  /// @brief Get the largest radius among the bodies placed in cells. Larger
+  /// bodies are candidates of every query, whatever its reach
+  double getMaxRadius() const {
+    return this->maxRadius;
+  }
+
+ private:
+  /// @brief Get the integer coordinate of the cell containing a coordinate
+  int64_t getCell(double coordinate) const;
+
+  /// @brief Hash integer cell coordinates into a key
+  static uint64_t getKey(int64_t cellX, int64_t cellY, int64_t cellZ);
+};
+
+#endif  // SPATIALGRID_HPP
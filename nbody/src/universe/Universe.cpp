@@ -2,18 +2,34 @@
 
 #include "Universe.hpp"
 
+#include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <fcntl.h>  // NOLINT[BUILD-LACK_INCLUDE_SCORE_ORDER]
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <omp.h>  // NOLINT[BUILD-LACK_INCLUDE_SCORE_ORDER]
 #include <sstream>
+#include <sys/mman.h>  // NOLINT[BUILD-LACK_INCLUDE_SCORE_ORDER]
+#include <sys/stat.h>  // NOLINT[BUILD-LACK_INCLUDE_SCORE_ORDER]
 #include <string>
+#include <unistd.h>  // NOLINT[BUILD-LACK_INCLUDE_SCORE_ORDER]
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "common.hpp"
 #include "Mpi.hpp"
+#include "Octree.hpp"
+#include "SpatialGrid.hpp"
 #include "Util.hpp"
 
+// Blocks of bodies per thread for the symmetric force evaluation
+#define SYMMETRIC_BLOCKS_PER_THREAD 4
+// Smallest block worth a pair of blocks as a unit of work
+#define SYMMETRIC_MIN_BLOCK_SIZE 256
+
 // Return true if arguments were set, false if default arguments are needed
 bool Universe::analyzeRandomUniverseModeArguments(int argc, char* argv[]) {
   if (argc < 12) {
@@ -47,6 +63,20 @@ bool Universe::analyzeRandomUniverseModeArguments(int argc, char* argv[]) {
 // Loads universe state from file, distributing bodies across MPI processes
 size_t Universe::loadUniverse(std::string universeFile, size_t rank,
     size_t size) {
+  // Binary files are recognized by their first bytes, whatever their name
+  const size_t totalBodyCount = Universe::isBinaryUniverse(universeFile)
+    ? this->loadBinaryUniverse(universeFile, rank, size)
+    : this->loadTsvUniverse(universeFile, rank, size);
+  this->activeBodiesCount = this->bodies.size();
+  const size_t start = Util::calculateStart(rank, totalBodyCount, size);
+  for (size_t index = 0; index < this->bodies.size(); ++index) {
+    this->bodyIds.push_back(start + index);
+  }
+  return totalBodyCount;
+}
+
+size_t Universe::loadTsvUniverse(const std::string& universeFile,
+    size_t rank, size_t size) {
   size_t totalBodyCount = 0;
   std::ifstream file(universeFile);
   if (!file) {
@@ -74,7 +104,67 @@ size_t Universe::loadUniverse(std::string universeFile, size_t rank,
     throw std::invalid_argument("invalid body arguments in universe file");
   }
   file.close();
-  this->activeBodiesCount = this->bodies.size();
+  return totalBodyCount;
+}
+
+bool Universe::isBinaryUniverse(const std::string& universeFile) {
+  char magic[BINARY_UNIVERSE_MAGIC_SIZE] = {};
+  std::ifstream file(universeFile, std::ios::binary);
+  file.read(magic, BINARY_UNIVERSE_MAGIC_SIZE);
+  return file && std::memcmp(magic, BINARY_UNIVERSE_MAGIC,
+    BINARY_UNIVERSE_MAGIC_SIZE) == 0;
+}
+
+size_t Universe::loadBinaryUniverse(const std::string& universeFile,
+    size_t rank, size_t size) {
+  const int descriptor = ::open(universeFile.c_str(), O_RDONLY);
+  if (descriptor < 0) {
+    throw std::invalid_argument("cannot open universe file");
+  }
+  uint64_t totalBodyCount = 0;
+  struct stat status;
+  if (::fstat(descriptor, &status) != 0 || ::pread(descriptor,
+      &totalBodyCount, sizeof totalBodyCount, BINARY_UNIVERSE_MAGIC_SIZE)
+      != sizeof totalBodyCount) {
+    ::close(descriptor);
+    throw std::runtime_error("cannot read universe file header");
+  }
+  const size_t recordSize = BODY_COLLISION_DATA_SIZE * sizeof(double);
+  // Divide instead of multiplying, a corrupt count could overflow
+  const size_t fileSize = static_cast<size_t>(status.st_size);
+  const size_t recordCount = fileSize < BINARY_UNIVERSE_HEADER_SIZE ? 0 :
+    (fileSize - BINARY_UNIVERSE_HEADER_SIZE) / recordSize;
+  if (totalBodyCount > recordCount) {
+    ::close(descriptor);
+    throw std::runtime_error("truncated universe file");
+  }
+  // Bodies are counted with int elsewhere
+  if (totalBodyCount > static_cast<uint64_t>(
+      std::numeric_limits<int>::max())) {
+    ::close(descriptor);
+    throw std::runtime_error("too many bodies in universe file");
+  }
+  if (totalBodyCount < size) {
+    ::close(descriptor);
+    throw std::runtime_error("insufficient bodies in universe");
+  }
+  // Map only the pages that hold the records of this process
+  const size_t start = Util::calculateStart(rank, totalBodyCount, size);
+  const size_t count = Util::calculateFinish(rank, totalBodyCount, size)
+    - start;
+  const size_t first = BINARY_UNIVERSE_HEADER_SIZE + start * recordSize;
+  const size_t pageStart = first - first % ::sysconf(_SC_PAGESIZE);
+  const size_t length = first + count * recordSize - pageStart;
+  void* mapped = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor,
+    pageStart);
+  ::close(descriptor);
+  if (mapped == MAP_FAILED) {
+    throw std::runtime_error("cannot map universe file");
+  }
+  ::madvise(mapped, length, MADV_SEQUENTIAL);
+  this->bodies.appendRecords(reinterpret_cast<const double*>(
+    static_cast<const char*>(mapped) + (first - pageStart)), count);
+  ::munmap(mapped, length);
   return totalBodyCount;
 }
 
@@ -107,7 +197,7 @@ void Universe::loadBody(std::ifstream& file, std::string& line) {
   }
   // Util::split(row, "\t", true);
   // Create and store new body
-  this->bodies.push_back(Body(
+  this->bodies.pushBack(Body(
     std::stod(row[0]),  // mass
     std::stod(row[1]),  // radius
     // position (x, y, z)
@@ -117,36 +207,38 @@ void Universe::loadBody(std::ifstream& file, std::string& line) {
 }
 
 // Creates a random universe with bodies distributed across MPI processes
-void Universe::createUniverse(size_t rank, size_t size, int totalBodiesCount) {
+void Universe::createUniverse(size_t rank, size_t size, int totalBodiesCount,
+    uint64_t seed) {
   // Calculate range of bodies this process should create
-  int start = Util::calculateStart(rank, totalBodiesCount, size);
-  int finish =  Util::calculateFinish(rank, totalBodiesCount, size);
-  int myBodiesCount = finish - start;
-  // Generate random bodies within specified parameter ranges
-  for (int index = 0; index < myBodiesCount; ++index) {
-    // Generate random values for new body, between specified ranges
-    double mass = Util::random(this->minMass, this->maxMass);
-    double radius = Util::random(this->minRadius, this->maxRadius);
-    // Randdom position
-    double positionX = Util::random(this->minPosition,
-        this->maxPosition);
-    double positionY = Util::random(this->minPosition,
-        this->maxPosition);
-    double positionZ = Util::random(this->minPosition,
-        this->maxPosition);
+  const size_t start = Util::calculateStart(rank, totalBodiesCount, size);
+  const size_t finish = Util::calculateFinish(rank, totalBodiesCount, size);
+  this->bodies.resize(finish - start);
+  this->bodyIds.resize(finish - start);
+  // Each property of each body has its own counter in the stream of the
+  // seed, so the universe is the same whatever the threads and processes
+  const uint64_t key = Util::mixBits(seed);
+  #pragma omp parallel for num_threads(omp_get_max_threads()) \
+    schedule(static) default(none) shared(start, finish, key)
+  for (size_t id = start; id < finish; ++id) {
+    const uint64_t counter = id * BODY_COLLISION_DATA_SIZE;
+    double record[BODY_COLLISION_DATA_SIZE];
+    record[COLLISION_MASS] = Util::random(key, counter + COLLISION_MASS,
+      this->minMass, this->maxMass);
+    record[COLLISION_RADIUS] = Util::random(key, counter + COLLISION_RADIUS,
+      this->minRadius, this->maxRadius);
+    // Random position
+    for (size_t axis = 0; axis < BODY_DISTANCE_DATA_SIZE; ++axis) {
+      record[COLLISION_POSITION_X + axis] = Util::random(key, counter +
+        COLLISION_POSITION_X + axis, this->minPosition, this->maxPosition);
+    }
     // Random velocity
-    double velocityX = Util::random(this->minVelocity,
-        this->maxVelocity);
-    double velocityY = Util::random(this->minVelocity,
-        this->maxVelocity);
-    double velocityZ = Util::random(this->minVelocity,
-        this->maxVelocity);
-    // Create and store new random body
-    this->bodies.push_back(Body(
-      mass,
-      radius,
-      RealVector(positionX, positionY, positionZ),
-      RealVector(velocityX, velocityY, velocityZ)));
+    for (size_t axis = 0; axis < BODY_VELOCITY_DATA_SIZE; ++axis) {
+      record[COLLISION_VELOCITY_X + axis] = Util::random(key, counter +
+        COLLISION_VELOCITY_X + axis, this->minVelocity, this->maxVelocity);
+    }
+    // Store the new random body in place
+    this->bodies.setRecord(id - start, record);
+    this->bodyIds[id - start] = id;
   }
   // Set current active bodies count as amount of bodies created
   this->activeBodiesCount = this->bodies.size();
@@ -155,9 +247,27 @@ void Universe::createUniverse(size_t rank, size_t size, int totalBodiesCount) {
 
 // Serializes body data for collision detection
 void Universe::serializeCollisionData(std::vector<double>& serializedBodies) {
-  for (const Body& body : this->bodies) {
-    if (body.isActive()) {
-      body.serializeCheckCollision(serializedBodies);
+  this->serializedIndexes.clear();
+  for (size_t index = 0; index < this->bodies.size(); ++index) {
+    if (this->bodies.isActive(index)) {
+      this->bodies.serializeCheckCollision(index, serializedBodies);
+      this->serializedIndexes.push_back(index);
+    }
+  }
+}
+
+// Serializes the masses changed by collisions after serializeCollisionData
+void Universe::serializeMassChanges(
+    const std::vector<double>& serializedBodies,
+    std::vector<double>& changes) const {
+  for (size_t body = 0; body < this->serializedIndexes.size(); ++body) {
+    const size_t index = this->serializedIndexes[body];
+    const double mass = this->bodies.isActive(index) ?
+      this->bodies.masses[index] : 0.0;
+    if (mass != serializedBodies[body * BODY_COLLISION_DATA_SIZE +
+        COLLISION_MASS]) {
+      changes.push_back(static_cast<double>(body));
+      changes.push_back(mass);
     }
   }
 }
@@ -165,205 +275,1019 @@ void Universe::serializeCollisionData(std::vector<double>& serializedBodies) {
 // Serializes body data for acceleration calculations
 void Universe::serializeAccelerationData
   (std::vector<double>& serializedBodies) {
-  for (const Body& body : this->bodies) {
-    if (body.isActive()) {
-      body.serializeAccelerationData(serializedBodies);
+  for (size_t index = 0; index < this->bodies.size(); ++index) {
+    if (this->bodies.isActive(index)) {
+      this->bodies.serializeAccelerationData(index, serializedBodies);
+    }
+  }
+}
+
+// Serializes body data for acceleration calculations in single precision
+void Universe::serializeAccelerationData(
+    std::vector<float>& serializedBodies) {
+  for (size_t index = 0; index < this->bodies.size(); ++index) {
+    if (this->bodies.isActive(index)) {
+      serializedBodies.push_back(static_cast<float>(
+        this->bodies.masses[index]));
+      serializedBodies.push_back(static_cast<float>(
+        this->bodies.positionsX[index]));
+      serializedBodies.push_back(static_cast<float>(
+        this->bodies.positionsY[index]));
+      serializedBodies.push_back(static_cast<float>(
+        this->bodies.positionsZ[index]));
     }
   }
 }
 
-// Saves current universe state to file (parallel version)
-void Universe::saveBodiesFile(std::string universeFile,
-    double currentTime, const int rank, const int totalBodyCount) const {
+std::string Universe::getFileStem(const std::string& universeFile) {
   // remove the file extension from the universe file
-  std::string fileName = universeFile.substr(0, universeFile.find_last_of('.'));
-  fileName += "-" +std::to_string(static_cast<int>(currentTime)) + ".tsv";
-  // Append if rank != 0
-  std::ofstream file = std::ofstream();
+  return universeFile.substr(0, universeFile.find_last_of('.'));
+}
+
+std::string Universe::getStateFileName(const std::string& universeFile,
+    double currentTime) {
+  return Universe::getFileStem(universeFile) + "-" +
+    std::to_string(static_cast<int>(currentTime)) + ".tsv";
+}
+
+void Universe::formatBodiesFile(std::string& text, int rank,
+    size_t totalBodyCount) const {
+  std::ostringstream lines;
   if (rank == 0) {
-    // Restart and write the total body totalActiveCount only once
-    file.open(fileName);
-    file << totalBodyCount << std::endl;
-  } else {
-    file.open(fileName, std::ios::app);
+    lines << totalBodyCount << '\n';
   }
-  if (!file) {
-    std::cerr << "Cannot open file for writing: " << fileName << std::endl;
-    throw std::runtime_error("cannot save bodies file");
+  for (size_t index = 0; index < this->bodies.size(); ++index) {
+    lines << this->bodies.getBody(index) << '\n';
+  }
+  text += lines.str();
+}
+
+void Universe::formatBinaryFile(std::string& data, int rank,
+    size_t totalBodyCount) const {
+  if (rank == 0) {
+    const uint64_t bodyCount = totalBodyCount;
+    data.append(BINARY_UNIVERSE_MAGIC, BINARY_UNIVERSE_MAGIC_SIZE);
+    data.append(reinterpret_cast<const char*>(&bodyCount), sizeof bodyCount);
   }
-  // Write all bodies managed by this process
-  for (const Body& body : this->bodies) {
-    file << body << std::endl;
+  std::vector<double> records;
+  records.reserve(this->bodies.size() * BODY_COLLISION_DATA_SIZE);
+  for (size_t index = 0; index < this->bodies.size(); ++index) {
+    this->bodies.serializeCheckCollision(index, records);
   }
-  file.close();
+  data.append(reinterpret_cast<const char*>(records.data()),
+    records.size() * sizeof(double));
 }
 
 // Checks for collisions between local bodies
 void Universe::checkCollisions() {
+  // Positions do not change while checking collisions, so the grid is built
+  // once. Only bodies active now can collide, later ones are skipped anyway
+  #pragma omp single
+  {
+    this->collisionGrid.build(this->bodies.positionsX.data(),
+      this->bodies.positionsY.data(), this->bodies.positionsZ.data(),
+      this->bodies.radiuses.data(), this->bodies.size(),
+      this->bodies.actives.data());
+    this->collisionPairs.clear();
+  }
+  this->detectCollisions(this->collisionPairs);
+  #pragma omp single
+  this->resolveCollisions(this->collisionPairs);
+}
+
+void Universe::detectCollisions(
+    std::vector<std::pair<size_t, size_t>>& collisions) {
+  const double maxRadius = this->collisionGrid.getMaxRadius();
+  // Bodies are only read here, so every thread checks its own bodies
+  std::vector<size_t> candidates;
+  std::vector<std::pair<size_t, size_t>> myCollisions;
+  #pragma omp for schedule(dynamic, 64) nowait
+  for (size_t index = 0; index < this->bodies.size(); ++index) {
+    if (!this->bodies.isActive(index)) {
+      continue;  // Skip inactive bodies
+    }
+    this->collisionGrid.query(this->bodies.positionsX[index],
+      this->bodies.positionsY[index], this->bodies.positionsZ[index],
+      this->bodies.radiuses[index] + maxRadius, candidates);
+    for (const size_t other_index : candidates) {
+      if (index != other_index && this->bodies.isActive(other_index) &&
+          this->bodies.checkCollision(index, other_index)) {
+        myCollisions.emplace_back(index, other_index);
+      }
+    }
+  }
+  #pragma omp critical(can_access_collisions)
+  collisions.insert(collisions.end(), myCollisions.begin(),
+    myCollisions.end());
+  #pragma omp barrier
+  // Threads finish in any order, sort as the serial loops would find them
+  #pragma omp single
+  std::sort(collisions.begin(), collisions.end());
+}
+
+void Universe::resolveCollisions(
+    const std::vector<std::pair<size_t, size_t>>& collisions) {
+  // Pairs detected in parallel are exact until a merge grows a radius.
+  // Grown bodies are searched again in the grid, and bodies that may now
+  // touch a grown one get it as an extra candidate
+  const double initialMaxRadius = this->collisionGrid.getMaxRadius();
+  double maxRadius = initialMaxRadius;
+  std::vector<uint8_t> grown(this->bodies.size(), 0);
+  std::unordered_map<size_t, std::vector<size_t>> extraCandidates;
+  std::vector<size_t> candidates;
+  std::vector<size_t> nearby;
+  auto nextCollision = collisions.begin();
+
   for (size_t index = 0; index < this->bodies.size(); ++index) {
-    if (!this->bodies[index].isActive()) {
+    // Pairs detected for this body
+    const auto firstCollision = nextCollision;
+    while (nextCollision != collisions.end() &&
+        nextCollision->first == index) {
+      ++nextCollision;
+    }
+    if (!this->bodies.isActive(index)) {
       continue;  // Skip inactive bodies
     }
-    // Check against all other bodies
-    for (size_t other_index = 0; other_index < this->bodies.size();
-        ++other_index) {
-      if (index == other_index || !this->bodies[other_index].isActive()) {
-        continue;  // Skip self-comparison
+    // Map references stay valid when other bodies get extra candidates
+    const auto found = extraCandidates.find(index);
+    const std::vector<size_t>* extras = found == extraCandidates.end() ?
+      nullptr : &found->second;
+    if (firstCollision == nextCollision && !grown[index] && !extras) {
+      continue;  // Nothing can collide with this body
+    }
+    // Check against candidates in ascending order, as if checking all
+    size_t nextIndex = 0;
+    bool searching = true;
+    while (searching) {
+      searching = false;
+      const bool searchGrid = grown[index];
+      const double reach = this->bodies.radiuses[index] + maxRadius;
+      if (searchGrid) {
+        this->collisionGrid.query(this->bodies.positionsX[index],
+          this->bodies.positionsY[index], this->bodies.positionsZ[index],
+          reach, candidates);
+      } else {
+        candidates.clear();
+        for (auto pair = firstCollision; pair != nextCollision; ++pair) {
+          candidates.push_back(pair->second);
+        }
+        if (extras) {
+          candidates.insert(candidates.end(), extras->begin(),
+            extras->end());
+          std::sort(candidates.begin(), candidates.end());
+          candidates.erase(std::unique(candidates.begin(), candidates.end()),
+            candidates.end());
+        }
       }
-      if (this->bodies[index].checkCollision(this->bodies[other_index])) {
-        // #pragma omp critical
-        --this->activeBodiesCount;
+      for (const size_t other_index : candidates) {
+        if (other_index < nextIndex) {
+          continue;  // Already checked before the search was widened
+        }
+        nextIndex = other_index + 1;
+        if (index == other_index || !this->bodies.isActive(other_index)) {
+          continue;  // Skip self-comparison
+        }
+        if (!this->bodies.checkCollision(index, other_index)) {
+          continue;
+        }
         // Let the more massive body absorb the smaller one
-        if (!this->bodies[index].absorb(this->bodies[other_index])) {
-          this->bodies[other_index].absorb(this->bodies[index]);
+        const size_t absorber = this->bodies.absorb(index, other_index) ?
+          index : other_index;
+        if (absorber == other_index) {
+          this->bodies.absorb(other_index, index);
+        }
+        grown[absorber] = 1;
+        maxRadius = std::max(maxRadius, this->bodies.radiuses[absorber]);
+        // Bodies checked later may reach the absorber now
+        this->collisionGrid.query(this->bodies.positionsX[absorber],
+          this->bodies.positionsY[absorber],
+          this->bodies.positionsZ[absorber],
+          this->bodies.radiuses[absorber] + initialMaxRadius, nearby);
+        for (const size_t near_index : nearby) {
+          if (near_index > index) {
+            extraCandidates[near_index].push_back(absorber);
+          }
+        }
+        // Search again if the merge made bodies beyond reach collidable
+        if (grown[index] && (!searchGrid ||
+            this->bodies.radiuses[index] + maxRadius > reach)) {
+          searching = true;
+          break;
         }
       }
     }
   }
+  // A body absorbed while it was being checked can still be met again
+  this->countActiveBodies();
 }
 
 void Universe::checkCollisions(std::vector<double>& serializedBodies,
     const int rank, const int otherRank) {
-  // Parallel for iterating through every local bodies
-  // omitting default(none) given no private data
+  // Place the other process' bodies in a grid, remote bodies do not change
+  const size_t remoteCount = serializedBodies.size() /
+    BODY_COLLISION_DATA_SIZE;
+  #pragma omp single
+  {
+    this->remoteSources.masses.resize(remoteCount);
+    this->remoteSources.positionsX.resize(remoteCount);
+    this->remoteSources.positionsY.resize(remoteCount);
+    this->remoteSources.positionsZ.resize(remoteCount);
+    this->remoteRadiuses.resize(remoteCount);
+    for (size_t remote = 0; remote < remoteCount; ++remote) {
+      const size_t offset = remote * BODY_COLLISION_DATA_SIZE;
+      this->remoteSources.masses[remote] =
+        serializedBodies[offset + COLLISION_MASS];
+      this->remoteRadiuses[remote] =
+        serializedBodies[offset + COLLISION_RADIUS];
+      this->remoteSources.positionsX[remote] =
+        serializedBodies[offset + COLLISION_POSITION_X];
+      this->remoteSources.positionsY[remote] =
+        serializedBodies[offset + COLLISION_POSITION_Y];
+      this->remoteSources.positionsZ[remote] =
+        serializedBodies[offset + COLLISION_POSITION_Z];
+    }
+    this->collisionGrid.build(this->remoteSources.positionsX.data(),
+      this->remoteSources.positionsY.data(),
+      this->remoteSources.positionsZ.data(), this->remoteRadiuses.data(),
+      remoteCount);
+  }
+  const double maxRadius = this->collisionGrid.getMaxRadius();
+
+  // Every thread of the team checks its own local bodies
   // No race conditions given bodies from other processes are not modified.
-  #pragma omp parallel for num_threads(omp_get_max_threads()) schedule(dynamic)
+  std::vector<size_t> candidates;
+  #pragma omp for schedule(dynamic)
   for (size_t index = 0; index < this->bodies.size(); ++index) {
-    if (!this->bodies[index].isActive()) {
+    if (!this->bodies.isActive(index)) {
       continue;  // Skip if current body is not active
     }
-    // Check collision for current body with every single serialized body sent
-    for (size_t offset = 0; offset < serializedBodies.size();
-        offset += BODY_COLLISION_DATA_SIZE) {
-      // Build auxiliary vectors for position and velocity to check collision
-      RealVector otherPosition = RealVector(serializedBodies[offset +
-        COLLISION_POSITION_X],  serializedBodies[offset + COLLISION_POSITION_Y],
-        serializedBodies[offset +  COLLISION_POSITION_Z]);
-      RealVector otherVelocity = RealVector(serializedBodies[offset +
-        COLLISION_VELOCITY_X],  serializedBodies[offset + COLLISION_VELOCITY_Y],
-        serializedBodies[offset + COLLISION_VELOCITY_Z]);
-
+    // Check collision for current body with the nearby serialized bodies,
+    // in the order they were sent
+    this->collisionGrid.query(this->bodies.positionsX[index],
+      this->bodies.positionsY[index], this->bodies.positionsZ[index],
+      this->bodies.radiuses[index] + maxRadius, candidates);
+    for (const size_t remote : candidates) {
+      const size_t offset = remote * BODY_COLLISION_DATA_SIZE;
       // If the current body collides
-      if (this->bodies[index].checkCollision(
-          serializedBodies[offset + COLLISION_RADIUS], otherPosition)) {
-        this->collideBodies(this->bodies[index], serializedBodies,
-            otherVelocity, offset, rank, otherRank);
+      if (this->bodies.checkCollision(index, this->remoteRadiuses[remote],
+          this->remoteSources.positionsX[remote],
+          this->remoteSources.positionsY[remote],
+          this->remoteSources.positionsZ[remote])) {
+        // Build auxiliary vector for velocity to merge the bodies
+        RealVector otherVelocity = RealVector(serializedBodies[offset +
+          COLLISION_VELOCITY_X], serializedBodies[offset +
+          COLLISION_VELOCITY_Y], serializedBodies[offset +
+          COLLISION_VELOCITY_Z]);
+        this->collideBodies(index, serializedBodies, otherVelocity, offset,
+          rank, otherRank);
         break;
       }
     }
   }
+  #pragma omp single
+  this->countActiveBodies();
 }
 
-void Universe::collideBodies(Body& body, std::vector<double>& serializedBodies
+void Universe::collideBodies(size_t index,
+    std::vector<double>& serializedBodies
     , const RealVector& otherVelocity, const size_t offset, const int rank,
     const int otherRank) {
   // Get other body's mass
   double otherMass = serializedBodies[offset + COLLISION_MASS];
   // If both have equal masses, the one from lower rank absorbs the one
   // managed by a process with higher rank. Skip if my rank is lower
-  if (body.equalMasses(otherMass) && rank < otherRank) {
-    body.deactivate();
-    #pragma omp atomic
-    --this->activeBodiesCount;
+  if (this->bodies.equalMasses(index, otherMass) && rank < otherRank) {
+    this->bodies.deactivate(index);
     return;  // Skip the absorb attempt
   }
 
   // If this body could not absorb the other process's one, deactivate
-  if (!body.absorb(otherMass,
+  if (!this->bodies.absorb(index, otherMass,
       serializedBodies[offset + COLLISION_RADIUS], otherVelocity)) {
-    body.deactivate();
-    #pragma omp atomic
-    --this->activeBodiesCount;
+    this->bodies.deactivate(index);
+  }
+}
+
+void Universe::countActiveBodies() {
+  int count = 0;
+  for (size_t index = 0; index < this->bodies.size(); ++index) {
+    count += this->bodies.isActive(index);
   }
+  this->activeBodiesCount = count;
 }
 
-void Universe::updateAccelerations() {
-  std::vector<Body>& tempBodies = this->bodies;
-  #pragma omp parallel num_threads(omp_get_max_threads()) \
-    default(none) shared(tempBodies)
+void Universe::updateAccelerations(bool symmetric,
+    const std::function<void()>& progress) {
+  BodyStore& tempBodies = this->bodies;
+  #pragma omp single
   {
-    // Must reset accelerations separately first
-    this->resetAccelerations(tempBodies);
-    #pragma omp barrier
-    // After ensuring all accelerations have been reset, update
+    this->sourceMasses.resize(tempBodies.size());
+    if (this->mixedPrecision) {
+      this->floatSources.resize(tempBodies.size());
+    }
+    if (symmetric) {
+      this->pairAccelerationsX.resize(tempBodies.size());
+      this->pairAccelerationsY.resize(tempBodies.size());
+      this->pairAccelerationsZ.resize(tempBodies.size());
+    }
+  }
+  // Must reset accelerations separately first
+  this->resetAccelerations(tempBodies);
+  #pragma omp barrier
+  // After ensuring all accelerations have been reset, update
+  if (symmetric) {
+    this->updateLocalAccelerationsSymmetric(tempBodies);
+  } else {
+    if (progress) {
+      #pragma omp master
+      progress();
+    }
     this->updateLocalAccelerations(tempBodies);
   }
 }
 
-void Universe::resetAccelerations(std::vector<Body>& tempBodies) {
+void Universe::resetAccelerations(BodyStore& tempBodies) {
   // First reset every body's acceleration
   #pragma omp for schedule(dynamic)
-  for (Body& body : tempBodies) {
+  for (size_t index = 0; index < tempBodies.size(); ++index) {
     // Only do so if body is active
-    if (body.isActive()) {
-      body.resetAcceleration();
+    if (tempBodies.isActive(index)) {
+      tempBodies.resetAcceleration(index);
+      this->sourceMasses[index] = tempBodies.masses[index];
+    } else {
+      // Inactive bodies must not pull on others
+      this->sourceMasses[index] = 0.0;
     }
+    if (this->mixedPrecision) {
+      this->floatSources.set(index, this->sourceMasses[index],
+        tempBodies.positionsX[index], tempBodies.positionsY[index],
+        tempBodies.positionsZ[index]);
+    }
+  }
+}
+
+void Universe::updateLocalAccelerations(BodyStore& tempBodies) {
+  // Inactive bodies have zero mass and the body itself is at distance zero,
+  // so the kernel can sweep every body without branching
+  if (this->mixedPrecision) {
+    this->sweepAccelerations(tempBodies, this->floatSources.getSources());
+  } else {
+    this->sweepAccelerations(tempBodies,
+      tempBodies.getSources(this->sourceMasses));
   }
 }
 
-void Universe::updateLocalAccelerations(std::vector<Body>& tempBodies) {
+template <typename Sources>
+void Universe::sweepAccelerations(BodyStore& tempBodies,
+    const Sources& sources) {
+  if (!this->localTileSize || !this->sourceTileSize) {
+    // Dynamic distribution given inactive bodies are not evaluated
+    #pragma omp for schedule(dynamic)
+    for (size_t i = 0; i < tempBodies.size(); ++i) {
+      if (tempBodies.isActive(i)) {
+        tempBodies.updateAcceleration(i, sources);
+      }
+    }
+    return;
+  }
+  const size_t localTiles = (tempBodies.size() + this->localTileSize - 1) /
+    this->localTileSize;
   #pragma omp for schedule(dynamic)
-  for (size_t i = 0; i < tempBodies.size(); ++i) {
-    Body& body = tempBodies[i];
-    if (!body.isActive()) {
-      continue;  // Skip inactive bodies
+  for (size_t localTile = 0; localTile < localTiles; ++localTile) {
+    const size_t localBegin = localTile * this->localTileSize;
+    const size_t localEnd = std::min(tempBodies.size(),
+      localBegin + this->localTileSize);
+    // The tile of sources is reused by every body in the local tile
+    for (size_t sourceBegin = 0; sourceBegin < sources.count;
+        sourceBegin += this->sourceTileSize) {
+      const Sources tile = sources.slice(sourceBegin,
+        std::min(sources.count, sourceBegin + this->sourceTileSize));
+      for (size_t i = localBegin; i < localEnd; ++i) {
+        if (tempBodies.isActive(i)) {
+          tempBodies.updateAcceleration(i, tile);
+        }
+      }
+    }
+  }
+}
+
+void Universe::updateLocalAccelerationsSymmetric(BodyStore& tempBodies) {
+  const ForceSources sources = tempBodies.getSources(this->sourceMasses);
+  const size_t count = tempBodies.size();
+  // Enough blocks for every thread to take several pairs in each round
+  const size_t wantedBlocks = 2 * SYMMETRIC_BLOCKS_PER_THREAD *
+    omp_get_num_threads();
+  const size_t blockSize = std::max<size_t>(SYMMETRIC_MIN_BLOCK_SIZE,
+    (count + wantedBlocks - 1) / wantedBlocks);
+  size_t blockCount = (count + blockSize - 1) / blockSize;
+  // Pairing needs an even amount of blocks, the extra one is empty
+  blockCount += blockCount % 2;
+
+  #pragma omp for schedule(static)
+  for (size_t index = 0; index < count; ++index) {
+    this->pairAccelerationsX[index] = 0.0;
+    this->pairAccelerationsY[index] = 0.0;
+    this->pairAccelerationsZ[index] = 0.0;
+  }
+  // Blocks within a round are all different, so pairs write disjoint ranges
+  for (size_t round = 0; round < blockCount; ++round) {
+    const size_t pairCount = round + 1 < blockCount ? blockCount / 2
+      : blockCount;
+    #pragma omp for schedule(dynamic)
+    for (size_t pair = 0; pair < pairCount; ++pair) {
+      size_t first = 0, second = 0;
+      Universe::getBlockPair(blockCount, round, pair, first, second);
+      ForceKernel::accumulateSymmetric(sources,
+        std::min(count, first * blockSize),
+        std::min(count, (first + 1) * blockSize),
+        std::min(count, second * blockSize),
+        std::min(count, (second + 1) * blockSize),
+        this->pairAccelerationsX.data(), this->pairAccelerationsY.data(),
+        this->pairAccelerationsZ.data());
+    }
+  }
+  // Inactive bodies were pulled too, but keep their last acceleration
+  #pragma omp for schedule(static)
+  for (size_t index = 0; index < count; ++index) {
+    if (tempBodies.isActive(index)) {
+      tempBodies.accelerationsX[index] += this->pairAccelerationsX[index];
+      tempBodies.accelerationsY[index] += this->pairAccelerationsY[index];
+      tempBodies.accelerationsZ[index] += this->pairAccelerationsZ[index];
     }
+  }
+}
+
+// Round robin tournament: one block stays fixed while the others rotate
+void Universe::getBlockPair(size_t blockCount, size_t round, size_t pair,
+    size_t& first, size_t& second) {
+  const size_t rotating = blockCount - 1;
+  if (round == rotating) {
+    first = second = pair;  // Last round evaluates pairs inside each block
+  } else if (pair == 0) {
+    first = round;
+    second = rotating;
+  } else {
+    first = (round + pair) % rotating;
+    second = (round + rotating - pair) % rotating;
+  }
+}
+
+void Universe::updateAccelerations(std::vector<double>& serializedBodies,
+    const std::function<void()>& progress) {
+  // Scatter the other process' bodies into arrays for the force kernel
+  #pragma omp single
+  this->remoteSources.deserialize(serializedBodies);
+  // The sweep is dynamic, so the master takes what is left when it arrives
+  if (progress) {
+    #pragma omp master
+    progress();
+  }
+  this->sweepAccelerations(this->bodies, this->remoteSources.getSources());
+}
 
-    for (size_t j = 0; j < tempBodies.size(); ++j) {
-      if (i == j || !tempBodies[j].isActive()) {
-        continue;  // Skip self-comparison and inactive bodies
+void Universe::updateAccelerations(std::vector<float>& serializedBodies,
+    const std::function<void()>& progress) {
+  #pragma omp single
+  this->remoteFloatSources.deserialize(serializedBodies);
+  if (progress) {
+    #pragma omp master
+    progress();
+  }
+  this->sweepAccelerations(this->bodies,
+    this->remoteFloatSources.getSources());
+}
+
+void Universe::updateAccelerationsBarnesHut(
+    const std::vector<double>& serializedBodies, double theta) {
+  // The tree holds every active body of the universe
+  #pragma omp single
+  {
+    this->remoteSources.deserialize(serializedBodies);
+    for (size_t index = 0; index < this->bodies.size(); ++index) {
+      if (this->bodies.isActive(index)) {
+        this->remoteSources.append(this->bodies.masses[index],
+          this->bodies.positionsX[index], this->bodies.positionsY[index],
+          this->bodies.positionsZ[index]);
       }
-      body.updateAcceleration(tempBodies[j]);
     }
+    // The other threads take the subtrees spawned as tasks
+    this->octree = std::make_unique<Octree>(theta);
+    this->octree->build(this->remoteSources);
+  }
+
+  BodyStore& localBodies = this->bodies;
+  const Octree& octree = *this->octree;
+  #pragma omp for schedule(dynamic)
+  for (size_t index = 0; index < localBodies.size(); ++index) {
+    if (!localBodies.isActive(index)) {
+      continue;  // Skip inactive bodies
+    }
+    double accelerations[DIM] = {0.0, 0.0, 0.0};
+    octree.accumulate(localBodies.positionsX[index],
+      localBodies.positionsY[index], localBodies.positionsZ[index],
+      accelerations);
+    localBodies.accelerationsX[index] = accelerations[0];
+    localBodies.accelerationsY[index] = accelerations[1];
+    localBodies.accelerationsZ[index] = accelerations[2];
   }
 }
 
-void Universe::updateAccelerations(std::vector<double>& serializedBodies) {
-  // Local alias so omp's shared can use inside parallel for
-  std::vector<Body>& localBodies = this->bodies;
-  // Dynamic map distribution between threads given some bodies don't need to be
-  // evaluated if inactive
-  #pragma omp parallel for num_threads(omp_get_max_threads()) \
-    default(none) shared(localBodies, serializedBodies) schedule(dynamic)
-  for (size_t i = 0; i < localBodies.size(); ++i) {
-    Body& body = localBodies[i];  // Represents current body
-    if (!body.isActive()) {
+
+void Universe::updateVelocitiesAndPositions(double deltaTime,
+    double kickTime) {
+  BodyStore& tempBodies = this->bodies;
+  #pragma omp for schedule(dynamic)
+  for (size_t index = 0; index < tempBodies.size(); ++index) {
+    if (!tempBodies.isActive(index)) {
       continue;  // Skip inactive bodies
     }
+    tempBodies.updateVelocity(index, kickTime);  // Update velocity first
+    tempBodies.updatePosition(index, deltaTime);  // Update position after
+  }
+}
 
-    // Evaluate with data from every body from other process
-    for (size_t offset = 0; offset < serializedBodies.size();
-        offset += BODY_ACCELERATION_DATA_SIZE) {
-      // Create a real vector to represent other body's acceleration
-      RealVector otherPosition =
-        RealVector(serializedBodies[offset + ACCELERATION_POSITION_X],
-          serializedBodies[offset + ACCELERATION_POSITION_Y],
-          serializedBodies[offset + ACCELERATION_POSITION_Z]);
+void Universe::updateVelocities(double kickTime) {
+  BodyStore& tempBodies = this->bodies;
+  #pragma omp for schedule(static)
+  for (size_t index = 0; index < tempBodies.size(); ++index) {
+    if (tempBodies.isActive(index)) {
+      tempBodies.updateVelocity(index, kickTime);
+    }
+  }
+}
 
-      body.updateAcceleration(serializedBodies[offset + ACCELERATION_MASS],
-        otherPosition);
+void Universe::startTimeBins(bool closeSteps, double deltaTime, int maxBin,
+    double eta) {
+  BodyStore& tempBodies = this->bodies;
+  #pragma omp single
+  {
+    this->timeBins.resize(tempBodies.size(), 0);
+    // Sources for the sub-steps, masses do not change until the next block
+    this->sourceMasses.resize(tempBodies.size());
+  }
+  #pragma omp for schedule(static)
+  for (size_t index = 0; index < tempBodies.size(); ++index) {
+    if (!tempBodies.isActive(index)) {
+      this->sourceMasses[index] = 0.0;
+      continue;
+    }
+    this->sourceMasses[index] = tempBodies.masses[index];
+    if (closeSteps) {
+      tempBodies.updateVelocity(index,
+        std::ldexp(deltaTime, -this->timeBins[index]) / 2);
     }
+    // All bins are synchronized at the start of a block, any can be taken
+    this->timeBins[index] = this->chooseTimeBin(index, deltaTime, maxBin,
+      eta);
+    tempBodies.updateVelocity(index,
+      std::ldexp(deltaTime, -this->timeBins[index]) / 2);
   }
 }
 
+void Universe::setMirror(const std::vector<double>& serializedBodies,
+    const std::vector<int>& offsets, int rank) {
+  #pragma omp single
+  this->loadMirror(serializedBodies, offsets, rank);
+}
 
-void Universe::updateVelocitiesAndPositions(double deltaTime) {
-  // Local alias so omp's shared can use inside parallel for
-  std::vector<Body>& tempBodies = this->bodies;
-  #pragma omp parallel for num_threads(omp_get_max_threads()) \
-    default(none) shared(tempBodies, deltaTime) schedule(dynamic)
+void Universe::loadMirror(const std::vector<double>& serializedBodies,
+    const std::vector<int>& offsets, int rank) {
+  this->mirrorSources.masses.clear();
+  this->mirrorSources.positionsX.clear();
+  this->mirrorSources.positionsY.clear();
+  this->mirrorSources.positionsZ.clear();
+  this->mirrorVelocitiesX.clear();
+  this->mirrorVelocitiesY.clear();
+  this->mirrorVelocitiesZ.clear();
+  this->mirrorStarts.assign(offsets.size() - 1, 0);
+  for (size_t process = 0; process + 1 < offsets.size(); ++process) {
+    this->mirrorStarts[process] = this->mirrorVelocitiesX.size();
+    if (static_cast<int>(process) == rank) {
+      continue;
+    }
+    for (int offset = offsets[process]; offset < offsets[process + 1];
+        offset += BODY_COLLISION_DATA_SIZE) {
+      const double* body = serializedBodies.data() + offset;
+      this->mirrorSources.append(body[COLLISION_MASS],
+        body[COLLISION_POSITION_X], body[COLLISION_POSITION_Y],
+        body[COLLISION_POSITION_Z]);
+      this->mirrorVelocitiesX.push_back(body[COLLISION_VELOCITY_X]);
+      this->mirrorVelocitiesY.push_back(body[COLLISION_VELOCITY_Y]);
+      this->mirrorVelocitiesZ.push_back(body[COLLISION_VELOCITY_Z]);
+    }
+  }
+}
+
+void Universe::driftTimeBins(double time) {
+  BodyStore& tempBodies = this->bodies;
+  ForceSourceBuffer& mirror = this->mirrorSources;
+  #pragma omp for schedule(static) nowait
   for (size_t index = 0; index < tempBodies.size(); ++index) {
-    Body& currentBody = tempBodies[index];
-    if (!currentBody.isActive()) {
-      continue;  // Skip inactive bodies
+    if (tempBodies.isActive(index)) {
+      tempBodies.updatePosition(index, time);
+    }
+  }
+  // Same operations as the owner does, so the mirror stays exact
+  #pragma omp for schedule(static)
+  for (size_t index = 0; index < mirror.masses.size(); ++index) {
+    mirror.positionsX[index] = mirror.positionsX[index] +
+      this->mirrorVelocitiesX[index] * time;
+    mirror.positionsY[index] = mirror.positionsY[index] +
+      this->mirrorVelocitiesY[index] * time;
+    mirror.positionsZ[index] = mirror.positionsZ[index] +
+      this->mirrorVelocitiesZ[index] * time;
+  }
+}
+
+void Universe::advanceTimeBins(size_t subStep, double deltaTime, int maxBin,
+    double eta, std::vector<double>& changes) {
+  BodyStore& tempBodies = this->bodies;
+  const ForceSources localSources = tempBodies.getSources(this->sourceMasses);
+  const ForceSources remoteSources = this->mirrorSources.getSources();
+  std::vector<char>& advanced = this->advancedBodies;
+  #pragma omp single
+  advanced.assign(tempBodies.size(), false);
+  #pragma omp for schedule(dynamic)
+  for (size_t index = 0; index < tempBodies.size(); ++index) {
+    const int bin = this->timeBins[index];
+    // Bin k ends a step every 2^(maxBin - k) sub-steps
+    if (!tempBodies.isActive(index)
+        || subStep % (size_t(1) << (maxBin - bin)) != 0) {
+      continue;
+    }
+    tempBodies.resetAcceleration(index);
+    tempBodies.updateAcceleration(index, localSources);
+    tempBodies.updateAcceleration(index, remoteSources);
+    tempBodies.updateVelocity(index, std::ldexp(deltaTime, -bin) / 2);
+    // A coarser step can only start where its bin is synchronized
+    int newBin = this->chooseTimeBin(index, deltaTime, maxBin, eta);
+    while (newBin < bin
+        && subStep % (size_t(1) << (maxBin - newBin)) != 0) {
+      ++newBin;
+    }
+    this->timeBins[index] = newBin;
+    tempBodies.updateVelocity(index, std::ldexp(deltaTime, -newBin) / 2);
+    advanced[index] = true;
+  }
+  // Other processes know the bodies by their position in the serialization
+  #pragma omp single
+  for (size_t body = 0; body < this->serializedIndexes.size(); ++body) {
+    const size_t index = this->serializedIndexes[body];
+    if (advanced[index]) {
+      changes.push_back(static_cast<double>(body));
+      changes.push_back(tempBodies.velocitiesX[index]);
+      changes.push_back(tempBodies.velocitiesY[index]);
+      changes.push_back(tempBodies.velocitiesZ[index]);
+    }
+  }
+}
+
+void Universe::applyMirrorChanges(const std::vector<double>& changes,
+    const std::vector<int>& offsets, int rank) {
+  #pragma omp single
+  for (size_t process = 0; process + 1 < offsets.size(); ++process) {
+    if (static_cast<int>(process) == rank) {
+      continue;
+    }
+    for (int offset = offsets[process]; offset < offsets[process + 1];
+        offset += BODY_VELOCITY_CHANGE_SIZE) {
+      const size_t index = this->mirrorStarts[process] +
+        static_cast<size_t>(changes[offset]);
+      this->mirrorVelocitiesX[index] = changes[offset + 1];
+      this->mirrorVelocitiesY[index] = changes[offset + 2];
+      this->mirrorVelocitiesZ[index] = changes[offset + 3];
+    }
+  }
+}
+
+void Universe::finishTimeBins(double deltaTime) {
+  BodyStore& tempBodies = this->bodies;
+  #pragma omp for schedule(static)
+  for (size_t index = 0; index < tempBodies.size(); ++index) {
+    if (tempBodies.isActive(index)) {
+      tempBodies.updateVelocity(index,
+        std::ldexp(deltaTime, -this->timeBins[index]) / 2);
+    }
+  }
+}
+
+int Universe::getDeepestTimeBin() const {
+  int deepestBin = 0;
+  for (size_t index = 0; index < this->bodies.size(); ++index) {
+    if (this->bodies.isActive(index)) {
+      deepestBin = std::max(deepestBin, this->timeBins[index]);
+    }
+  }
+  return deepestBin;
+}
+
+int Universe::chooseTimeBin(size_t index, double deltaTime, int maxBin,
+    double eta) const {
+  const double accelerationX = this->bodies.accelerationsX[index] * G;
+  const double accelerationY = this->bodies.accelerationsY[index] * G;
+  const double accelerationZ = this->bodies.accelerationsZ[index] * G;
+  const double acceleration = std::sqrt(accelerationX * accelerationX
+    + accelerationY * accelerationY + accelerationZ * accelerationZ);
+  int bin = 0;
+  if (acceleration > 0.0) {
+    const double step = eta * std::sqrt(this->bodies.radiuses[index]
+      / acceleration);
+    while (bin < maxBin && std::ldexp(deltaTime, -bin) > step) {
+      ++bin;
     }
-    currentBody.updateVelocity(deltaTime);  // Update velocity first
-    currentBody.updatePosition(deltaTime);  // Update position accordingly
   }
+  return bin;
+}
+
+void Universe::rebalance(Mpi* mpi) {
+  // Inactive bodies are only kept for the output
+  std::vector<double> activeBodies;
+  for (size_t index = 0; index < this->bodies.size(); ++index) {
+    this->serializeMigrationData(index, this->bodies.isActive(index) ?
+      activeBodies : this->retiredBodies);
+  }
+  const int activeCount = static_cast<int>(activeBodies.size() /
+    BODY_MIGRATION_DATA_SIZE);
+  std::vector<int> activeCounts;
+  mpi->allGather(activeCount, activeCounts);
+  int first = 0;
+  int totalActiveCount = 0;
+  for (int process = 0; process < mpi->size(); ++process) {
+    first += process < mpi->rank() ? activeCounts[process] : 0;
+    totalActiveCount += activeCounts[process];
+  }
+  // Bodies keep their global order, so each process sends a contiguous
+  // range of its bodies to every process whose new range overlaps it
+  std::vector<int> counts(mpi->size(), 0);
+  for (int process = 0; process < mpi->size(); ++process) {
+    const int start = std::max(first, static_cast<int>(Util::calculateStart(
+      process, totalActiveCount, mpi->size())));
+    const int finish = std::min(first + activeCount, static_cast<int>(
+      Util::calculateFinish(process, totalActiveCount, mpi->size())));
+    counts[process] = std::max(0, finish - start) * BODY_MIGRATION_DATA_SIZE;
+  }
+  std::vector<double> received;
+  mpi->allToAllv(activeBodies, counts, received);
+  this->loadMigrationData(received);
+  this->reordered = true;
 }
 
-std::vector<RealVector> Universe::getMyDistances(Mpi* mpi) {
-  std::vector<RealVector> distances;  // Create vector of distances
+void Universe::sortMorton(Mpi* mpi) {
+  std::vector<double> activeBodies;
+  for (size_t index = 0; index < this->bodies.size(); ++index) {
+    this->serializeMigrationData(index, this->bodies.isActive(index) ?
+      activeBodies : this->retiredBodies);
+  }
+  // Lows and negated highs of the positions, so one MPI_MIN finds the box
+  std::vector<double> bounds(2 * DIM, std::numeric_limits<double>::max());
+  for (size_t offset = 0; offset < activeBodies.size();
+      offset += BODY_MIGRATION_DATA_SIZE) {
+    for (size_t axis = 0; axis < DIM; ++axis) {
+      const double position = activeBodies[offset + COLLISION_POSITION_X +
+        axis];
+      bounds[axis] = std::min(bounds[axis], position);
+      bounds[DIM + axis] = std::min(bounds[DIM + axis], -position);
+    }
+  }
+  std::vector<double> box(2 * DIM);
+  mpi->allReduce(bounds, box, MPI_MIN);
+  double extent = 0.0;
+  for (size_t axis = 0; axis < DIM; ++axis) {
+    extent = std::max(extent, -box[DIM + axis] - box[axis]);
+  }
+  // The same scale on every axis keeps the cells of the curve cubic
+  const double scale = extent > 0.0 ? (MORTON_CELLS - 1) / extent : 0.0;
+  const auto getKey = [&box, scale](const double* body) {
+    uint64_t key = 0;
+    for (size_t axis = 0; axis < DIM; ++axis) {
+      const uint64_t cell = static_cast<uint64_t>(
+        (body[COLLISION_POSITION_X + axis] - box[axis]) * scale);
+      key |= Universe::spreadBits(cell) << axis;
+    }
+    return key;
+  };
+  // Equal keys are ordered by file position, so the order is deterministic
+  const auto curveOrder = [&getKey](const double* first,
+      const double* second) {
+    const uint64_t firstKey = getKey(first);
+    const uint64_t secondKey = getKey(second);
+    return firstKey < secondKey || (firstKey == secondKey &&
+      first[MIGRATION_ID] < second[MIGRATION_ID]);
+  };
+  Universe::sortMigrationData(activeBodies, curveOrder);
+  // Regular samples of the sorted keys of every process choose the keys
+  // where the curve is split among processes
+  const size_t count = activeBodies.size() / BODY_MIGRATION_DATA_SIZE;
+  std::vector<uint64_t> samples;
+  for (int sample = 1; sample < mpi->size() && count > 0; ++sample) {
+    samples.push_back(getKey(activeBodies.data() + sample * count /
+      mpi->size() * BODY_MIGRATION_DATA_SIZE));
+  }
+  std::vector<uint64_t> allSamples;
+  std::vector<int> sampleOffsets;
+  mpi->allGatherv(samples, allSamples, sampleOffsets);
+  std::sort(allSamples.begin(), allSamples.end());
+  std::vector<uint64_t> splitters;
+  for (int process = 1; process < mpi->size() && !allSamples.empty();
+      ++process) {
+    splitters.push_back(allSamples[process * allSamples.size() /
+      mpi->size()]);
+  }
+  // Sorted bodies go in contiguous ranges to the processes
+  std::vector<int> counts(mpi->size(), 0);
+  for (size_t offset = 0; offset < activeBodies.size();
+      offset += BODY_MIGRATION_DATA_SIZE) {
+    const size_t process = std::upper_bound(splitters.begin(),
+      splitters.end(), getKey(activeBodies.data() + offset)) -
+      splitters.begin();
+    counts[process] += BODY_MIGRATION_DATA_SIZE;
+  }
+  std::vector<double> received;
+  mpi->allToAllv(activeBodies, counts, received);
+  Universe::sortMigrationData(received, curveOrder);
+  this->loadMigrationData(received);
+  this->reordered = true;
+  // Splitters only approximate even shares, rebalance keeps the curve order
+  this->rebalance(mpi);
+}
+
+uint64_t Universe::spreadBits(uint64_t value) {
+  // Each step doubles the gaps between groups of bits, ending with 2 zeroes
+  // after every bit of the 21 lowest ones
+  value &= MORTON_CELLS - 1;
+  value = (value | value << 32) & 0x1f00000000ffffull;
+  value = (value | value << 16) & 0x1f0000ff0000ffull;
+  value = (value | value << 8) & 0x100f00f00f00f00full;
+  value = (value | value << 4) & 0x10c30c30c30c30c3ull;
+  value = (value | value << 2) & 0x1249249249249249ull;
+  return value;
+}
+
+void Universe::sortMigrationData(std::vector<double>& serialized,
+    const std::function<bool(const double*, const double*)>& less) {
+  const size_t count = serialized.size() / BODY_MIGRATION_DATA_SIZE;
+  std::vector<size_t> order(count);
+  for (size_t record = 0; record < count; ++record) {
+    order[record] = record;
+  }
+  std::sort(order.begin(), order.end(), [&](size_t first, size_t second) {
+    return less(serialized.data() + first * BODY_MIGRATION_DATA_SIZE,
+      serialized.data() + second * BODY_MIGRATION_DATA_SIZE);
+  });
+  std::vector<double> sorted;
+  sorted.reserve(serialized.size());
+  for (const size_t record : order) {
+    sorted.insert(sorted.end(), serialized.begin() + record *
+      BODY_MIGRATION_DATA_SIZE, serialized.begin() + (record + 1) *
+      BODY_MIGRATION_DATA_SIZE);
+  }
+  serialized.swap(sorted);
+}
+
+void Universe::compact(double threshold) {
+  const size_t inactiveCount = this->bodies.size() - this->activeBodiesCount;
+  if (inactiveCount == 0 ||
+      inactiveCount <= threshold * static_cast<double>(this->bodies.size())) {
+    return;
+  }
+  // Stable in place: each active body moves down over the retired ones
+  size_t kept = 0;
+  for (size_t index = 0; index < this->bodies.size(); ++index) {
+    if (!this->bodies.isActive(index)) {
+      this->serializeMigrationData(index, this->retiredBodies);
+      continue;
+    }
+    if (kept != index) {
+      this->bodies.copyBody(index, kept);
+      this->bodyIds[kept] = this->bodyIds[index];
+      if (index < this->timeBins.size()) {
+        this->timeBins[kept] = this->timeBins[index];
+      }
+    }
+    ++kept;
+  }
+  this->bodies.resize(kept);
+  this->bodyIds.resize(kept);
+  if (!this->timeBins.empty()) {
+    this->timeBins.resize(kept);
+  }
+  this->reordered = true;
+}
+
+void Universe::restoreHomeOrder(Mpi* mpi, size_t totalBodyCount) {
+  // Compaction is local, so processes agree on whether anything moved
+  int reordered = 0;
+  mpi->allReduce(static_cast<int>(this->reordered), reordered, MPI_MAX);
+  if (!reordered) {
+    return;  // Bodies are still where they were loaded
+  }
+  std::vector<std::vector<double>> homeBodies(mpi->size());
+  // Place a serialized body in the outgoing data of the process it came from
+  const auto sendHome = [&](const double* body) {
+    int home = 0;
+    while (Util::calculateFinish(home, totalBodyCount, mpi->size()) <=
+        static_cast<size_t>(body[MIGRATION_ID])) {
+      ++home;
+    }
+    homeBodies[home].insert(homeBodies[home].end(), body,
+      body + BODY_MIGRATION_DATA_SIZE);
+  };
+  std::vector<double> body;
+  for (size_t index = 0; index < this->bodies.size(); ++index) {
+    body.clear();
+    this->serializeMigrationData(index, body);
+    sendHome(body.data());
+  }
+  for (size_t offset = 0; offset < this->retiredBodies.size();
+      offset += BODY_MIGRATION_DATA_SIZE) {
+    sendHome(this->retiredBodies.data() + offset);
+  }
+  this->retiredBodies.clear();
+  std::vector<double> outgoing;
+  std::vector<int> counts(mpi->size());
+  for (int process = 0; process < mpi->size(); ++process) {
+    counts[process] = static_cast<int>(homeBodies[process].size());
+    outgoing.insert(outgoing.end(), homeBodies[process].begin(),
+      homeBodies[process].end());
+  }
+  std::vector<double> received;
+  mpi->allToAllv(outgoing, counts, received);
+  // Sort the records by their position in the universe file
+  Universe::sortMigrationData(received, [](const double* first,
+      const double* second) {
+    return first[MIGRATION_ID] < second[MIGRATION_ID];
+  });
+  this->loadMigrationData(received);
+  this->reordered = false;
+}
+
+void Universe::serializeCheckpoint(std::vector<double>& serialized) const {
+  serialized.reserve(serialized.size() + (this->bodies.size() +
+    this->retiredBodies.size()) * BODY_MIGRATION_DATA_SIZE);
+  for (size_t index = 0; index < this->bodies.size(); ++index) {
+    this->serializeMigrationData(index, serialized);
+  }
+  serialized.insert(serialized.end(), this->retiredBodies.begin(),
+    this->retiredBodies.end());
+}
+
+void Universe::serializeTrajectory(size_t stride,
+    std::vector<uint32_t>& ids, std::vector<double>& positions) const {
+  for (size_t index = 0; index < this->bodies.size(); ++index) {
+    if (this->bodies.isActive(index) && this->bodyIds[index] % stride == 0) {
+      ids.push_back(static_cast<uint32_t>(this->bodyIds[index]));
+      positions.push_back(this->bodies.positionsX[index]);
+      positions.push_back(this->bodies.positionsY[index]);
+      positions.push_back(this->bodies.positionsZ[index]);
+    }
+  }
+}
+
+void Universe::loadCheckpoint(std::vector<double>& serialized) {
+  Universe::sortMigrationData(serialized, [](const double* first,
+      const double* second) {
+    return first[MIGRATION_ID] < second[MIGRATION_ID];
+  });
+  this->retiredBodies.clear();
+  this->loadMigrationData(serialized);
+  this->reordered = false;
+}
+
+void Universe::serializeMigrationData(size_t index,
+    std::vector<double>& serialized) const {
+  this->bodies.serializeCheckCollision(index, serialized);
+  serialized.push_back(static_cast<double>(this->bodyIds[index]));
+  serialized.push_back(index < this->timeBins.size() ?
+    this->timeBins[index] : 0.0);
+}
+
+void Universe::loadMigrationData(const std::vector<double>& serialized) {
+  const size_t count = serialized.size() / BODY_MIGRATION_DATA_SIZE;
+  this->bodies.clear();
+  this->bodyIds.clear();
+  this->timeBins.clear();
+  this->bodies.reserve(count);
+  this->activeBodiesCount = 0;
+  for (size_t offset = 0; offset < serialized.size();
+      offset += BODY_MIGRATION_DATA_SIZE) {
+    const double* body = serialized.data() + offset;
+    this->bodies.pushBack(Body(body[COLLISION_MASS], body[COLLISION_RADIUS],
+      RealVector(body[COLLISION_POSITION_X], body[COLLISION_POSITION_Y],
+        body[COLLISION_POSITION_Z]),
+      RealVector(body[COLLISION_VELOCITY_X], body[COLLISION_VELOCITY_Y],
+        body[COLLISION_VELOCITY_Z])));
+    this->bodyIds.push_back(static_cast<size_t>(body[MIGRATION_ID]));
+    if (this->usesTimeBins) {
+      this->timeBins.push_back(static_cast<int>(body[MIGRATION_TIME_BIN]));
+    }
+    if (this->bodies.isActive(this->bodies.size() - 1)) {
+      ++this->activeBodiesCount;
+    }
+  }
+}
+
+Statistics::Moments Universe::getMyDistances(Mpi* mpi) {
+  Statistics::Moments distances;  // Moments of the distances seen
   this->aggregateOwnDistances(distances);  // First add own distances
   // Prepare serialized distances
   std::vector<double> serializedPositions;
@@ -389,67 +1313,107 @@ std::vector<RealVector> Universe::getMyDistances(Mpi* mpi) {
 }
 
 void Universe::serializePositions(std::vector<double>& serializedPositions) {
-  for (const Body& body : this->bodies) {
+  for (size_t index = 0; index < this->bodies.size(); ++index) {
     // Only serialize active bodies' positions
-    if (body.isActive()) {
+    if (this->bodies.isActive(index)) {
       // Serialize position data
-      body.serializePositionData(serializedPositions);
+      this->bodies.serializePositionData(index, serializedPositions);
     }
   }
 }
 
-void Universe::aggregateOwnDistances(std::vector<RealVector>& distances) {
-  // Iterate through vector of bodies
-  for (size_t startBodyIdx = 0; startBodyIdx < bodies.size() - 1;
+void Universe::aggregateOwnDistances(Statistics::Moments& distances) {
+  // Rows get shorter, so threads take them as they finish
+  #pragma omp parallel for num_threads(omp_get_max_threads()) \
+    schedule(dynamic, 16) default(none) reduction(moments_merge:distances)
+  for (size_t startBodyIdx = 0; startBodyIdx < this->bodies.size();
       ++startBodyIdx) {
     // Skip iteration if starting body is not active
-    if (!this->bodies[startBodyIdx].isActive()) {
+    if (!this->bodies.isActive(startBodyIdx)) {
       continue;
     }
+    const RealVector startPosition = this->bodies.getPosition(startBodyIdx);
     // Iterate through bodies after the starting body
     for (size_t currentBodyIdx = startBodyIdx + 1; currentBodyIdx <
         this->bodies.size(); ++currentBodyIdx) {
-      if (startBodyIdx == currentBodyIdx) {
-        continue;
-      }
       // Only calculate distances with active bodies
-      if (this->bodies[currentBodyIdx].isActive()) {
+      if (this->bodies.isActive(currentBodyIdx)) {
         // Distance calculation
-        distances.push_back(this->bodies[startBodyIdx].getPosition() -
-            this->bodies[currentBodyIdx].getPosition());
+        distances.add(startPosition -
+          this->bodies.getPosition(currentBodyIdx));
       }
     }
   }
 }
 
-void Universe::aggregateDistances(std::vector<RealVector>& distances,
+void Universe::aggregateDistances(Statistics::Moments& distances,
     const std::vector<double>& serializedPositions) {
   // For every body in this process, evaluate distances from other bodies
+  #pragma omp parallel for num_threads(omp_get_max_threads()) \
+    schedule(static) default(none) shared(serializedPositions) \
+    reduction(moments_merge:distances)
   for (size_t myBodyIdx = 0; myBodyIdx < this->bodies.size(); ++myBodyIdx) {
     // Only add distance to sum if currentBody is active
-    if (this->bodies[myBodyIdx].isActive()) {
+    if (this->bodies.isActive(myBodyIdx)) {
+      const RealVector myPosition = this->bodies.getPosition(myBodyIdx);
       // Iterate through every serialized position
       for (size_t offset = 0; offset < serializedPositions.size();
           offset += BODY_DISTANCE_DATA_SIZE) {
-        // Build auxiliary position
-        std::vector<double> auxPosition = {serializedPositions[offset],
-          serializedPositions[offset + 1], serializedPositions[offset + 2]};
-        // Calculate distance and add to distances vector
-        distances.push_back(RealVector(auxPosition) -
-            this->bodies[myBodyIdx].getPosition());
+        // Calculate distance and add it to the moments
+        distances.add(RealVector(serializedPositions[offset],
+          serializedPositions[offset + 1], serializedPositions[offset + 2]) -
+          myPosition);
       }
     }
   }
 }
 
-std::vector<RealVector> Universe::getMyVelocities() const {
-  std::vector<RealVector> velocities;
-  // Allocate space needed for the vector to return
-  velocities.reserve(this->activeBodiesCount);
+void Universe::getMyPositions(Statistics::Moments& positions,
+    RealVector& rankedSum) const {
+  // Active bodies before the part of each thread, and then before the thread
+  std::vector<size_t> threadOffsets;
+  double rankedX = 0.0, rankedY = 0.0, rankedZ = 0.0;
+  #pragma omp parallel num_threads(omp_get_max_threads()) default(none) \
+    shared(positions, threadOffsets, rankedX, rankedY, rankedZ)
+  {
+    #pragma omp single
+    threadOffsets.assign(omp_get_num_threads() + 1, 0);
+    // Both loops give every thread the same part of the bodies
+    size_t activeCount = 0;
+    #pragma omp for schedule(static)
+    for (size_t index = 0; index < this->bodies.size(); ++index) {
+      activeCount += this->bodies.isActive(index);
+    }
+    threadOffsets[omp_get_thread_num() + 1] = activeCount;
+    #pragma omp barrier
+    #pragma omp single
+    for (size_t thread = 1; thread < threadOffsets.size(); ++thread) {
+      threadOffsets[thread] += threadOffsets[thread - 1];
+    }
+    double rank = threadOffsets[omp_get_thread_num()];
+    #pragma omp for schedule(static) reduction(moments_merge:positions) \
+      reduction(+:rankedX, rankedY, rankedZ)
+    for (size_t index = 0; index < this->bodies.size(); ++index) {
+      if (this->bodies.isActive(index)) {
+        positions.add(this->bodies.getPosition(index));
+        rankedX += rank * this->bodies.positionsX[index];
+        rankedY += rank * this->bodies.positionsY[index];
+        rankedZ += rank * this->bodies.positionsZ[index];
+        ++rank;
+      }
+    }
+  }
+  rankedSum = RealVector(rankedX, rankedY, rankedZ);
+}
+
+Statistics::Moments Universe::getMyVelocities() const {
+  Statistics::Moments velocities;
   // Iterate through every body stored
-  for (const Body& body : this->bodies) {
-    // Add body's velocity vector to collection
-    velocities.push_back(body.getVelocity());
+  #pragma omp parallel for num_threads(omp_get_max_threads()) \
+    schedule(static) default(none) reduction(moments_merge:velocities)
+  for (size_t index = 0; index < this->bodies.size(); ++index) {
+    // Add body's velocity vector to the moments
+    velocities.add(this->bodies.getVelocity(index));
   }
   return velocities;
 }
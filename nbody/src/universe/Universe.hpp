@@ -2,11 +2,20 @@
 #ifndef UNIVERSE_HPP
 #define UNIVERSE_HPP
 
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "common.hpp"
 #include "Body.hpp"
+#include "BodyStore.hpp"
+#include "ForceKernel.hpp"
+#include "Octree.hpp"
+#include "SpatialGrid.hpp"
+#include "Statistics.hpp"
 
 class Mpi;
 
@@ -14,6 +23,10 @@ class Mpi;
 /// @brief Represents a system containing multiple celestial bodies that
 // interact through gravitational forces, supporting simulation updates and MPI
 // communication.
+/// @details Methods that check collisions or update accelerations, velocities
+/// and positions are called by every thread of an OpenMP team, which share
+/// their work. Their arguments must be shared by the team too. Called
+/// outside a parallel region, they run in the calling thread alone.
 class Universe {
   DISABLE_COPY(Universe);  ///< Disable copy constructor and assignment operator
 
@@ -28,7 +41,59 @@ class Universe {
   double minVelocity = 0.0;
   double maxVelocity = 0.0;
   int activeBodiesCount = 0;  ///< Number of currently active bodies
-  std::vector<Body> bodies;   ///< Vector containing all bodies in the universe
+  BodyStore bodies;  ///< Structure-of-arrays with all bodies in the universe
+  /// Masses used as force sources, with inactive bodies masked as zeroes
+  std::vector<double> sourceMasses;
+  /// Bodies received from other processes, as force sources
+  ForceSourceBuffer remoteSources;
+  /// Radiuses of the bodies received from other processes
+  std::vector<double> remoteRadiuses;
+  /// Pair contributions to the accelerations of local bodies, see
+  /// updateLocalAccelerationsSymmetric
+  std::vector<double> pairAccelerationsX;
+  std::vector<double> pairAccelerationsY;
+  std::vector<double> pairAccelerationsZ;
+  /// Local bodies per tile of the direct force sweep, 0 disables tiling
+  size_t localTileSize = 0;
+  /// Source bodies per tile of the direct force sweep, 0 disables tiling
+  size_t sourceTileSize = 0;
+  /// Indexes of the bodies in the last serializeCollisionData, in order
+  std::vector<size_t> serializedIndexes;
+  /// True if direct accelerations use the single precision kernel
+  bool mixedPrecision = false;
+  /// True if bodies keep a time bin, see startTimeBins. The same in every
+  /// process, even one left without bodies, so migrated bins are not lost
+  bool usesTimeBins = false;
+  /// Local bodies as single precision sources, inactive ones masked
+  FloatForceSourceBuffer floatSources;
+  /// Bodies received from other processes in single precision
+  FloatForceSourceBuffer remoteFloatSources;
+  /// Broad phase for collision detection
+  SpatialGrid collisionGrid;
+  /// Pairs of local bodies colliding, see detectCollisions
+  std::vector<std::pair<size_t, size_t>> collisionPairs;
+  /// Tree of the last Barnes-Hut update
+  std::unique_ptr<Octree> octree;
+  /// Time bin of each local body, bin k advances in steps of
+  /// deltaTime / 2^k, see startTimeBins
+  std::vector<int> timeBins;
+  /// Bodies of other processes, drifted locally during a block step
+  ForceSourceBuffer mirrorSources;
+  /// Velocities of the bodies in mirrorSources
+  std::vector<double> mirrorVelocitiesX;
+  std::vector<double> mirrorVelocitiesY;
+  std::vector<double> mirrorVelocitiesZ;
+  /// Position in the mirror of the first body of each process
+  std::vector<size_t> mirrorStarts;
+  /// Bodies advanced in the last advanceTimeBins
+  std::vector<char> advancedBodies;
+  /// Position of each local body in the universe file, or creation order
+  std::vector<size_t> bodyIds;
+  /// Inactive bodies taken out of the arrays by rebalance or compact, as
+  /// MigrationData
+  std::vector<double> retiredBodies;
+  /// True if bodies were moved or taken out since they were loaded
+  bool reordered = false;
 
  public:
   /// @brief Default constructor.
@@ -41,7 +106,7 @@ class Universe {
   /// @return True if arguments are valid
   bool analyzeRandomUniverseModeArguments(int argc, char* argv[]);
 
-  /// @brief Load universe data from a TSV file.
+  /// @brief Load universe data from a TSV or binary file.
   /// @param universeFile The input file containing universe data.
   /// @param rank The process rank in MPI.
   /// @param size The total number of processes.
@@ -49,6 +114,23 @@ class Universe {
   size_t loadUniverse(std::string universeFile, size_t rank, size_t size);
 
  private:  // HELPER METHODS FOR UNIVERSE LOADING
+  /// @brief Load the bodies of this process from a TSV universe file
+  /// @see loadUniverse for the params
+  /// @return Number of bodies in the universe
+  size_t loadTsvUniverse(const std::string& universeFile, size_t rank,
+    size_t size);
+
+  /// @brief Check if a file starts with BINARY_UNIVERSE_MAGIC
+  static bool isBinaryUniverse(const std::string& universeFile);
+
+  /// @brief Load the bodies of this process from a binary universe file. Only
+  /// the pages holding them are mapped, and a team of threads scatters them
+  /// into the arrays
+  /// @see loadUniverse for the params
+  /// @return Number of bodies in the universe
+  size_t loadBinaryUniverse(const std::string& universeFile, size_t rank,
+    size_t size);
+
   /// @brief Calculates the bodiees count assigned to a process and moves cursor
   /// to the position in the file where reading starts.
   /// @param file Input file stream
@@ -69,23 +151,56 @@ class Universe {
   /// @param rank The process rank.
   /// @param size The total number of MPI processes.
   /// @param totalBodiesCount Total number of bodies in the simulation.
-  void createUniverse(size_t rank, size_t size, int totalBodiesCount);
+  /// @param seed Seed of the random numbers, the same in every process.
+  void createUniverse(size_t rank, size_t size, int totalBodiesCount,
+    uint64_t seed);
 
   /// @brief Serialize the current state of the simulation for file output.
   /// @param serializedBodies Vector to store the data.
   void serializeCollisionData(std::vector<double>& serializedBodies);
 
+  /// @brief Serialize the acceleration data rounded to single precision.
+  /// @param serializedBodies Vector to store the acceleration data.
+  void serializeAccelerationData(std::vector<float>& serializedBodies);
+
+  /// @brief Serialize the masses that changed since the last call to
+  /// serializeCollisionData, as pairs (body position in that serialization,
+  /// new mass). Bodies deactivated since then are sent with mass zero
+  /// @param serializedBodies Data returned by serializeCollisionData
+  /// @param changes Vector to store the pairs
+  void serializeMassChanges(const std::vector<double>& serializedBodies,
+    std::vector<double>& changes) const;
+
   /// @brief Serialize the acceleration vectors of each body.
   /// @param serializedBodies Vector to store the acceleration data.
   void serializeAccelerationData(std::vector<double>& serializedBodies);
 
-  /// @brief Save the state of the bodies to a file in TSV format.
-  /// @param universeFile Output file path.
+  /// @brief Get the name of a universe file without its extension
+  /// @param universeFile Path of the universe file.
+  static std::string getFileStem(const std::string& universeFile);
+
+  /// @brief Get the name of the file where the state of the universe at a
+  /// time is saved, e.g. univ002-7200.tsv for univ002.tsv
+  /// @param universeFile Path of the universe file.
   /// @param currentTime Current simulation time.
-  /// @param rank Rank of the writing process.
-  /// @param totalBodyCount Total active bodies in the simulation.
-  void saveBodiesFile(std::string universeFile, double currentTime, int rank,
-    const int totalBodyCount) const;
+  static std::string getStateFileName(const std::string& universeFile,
+    double currentTime);
+
+  /// @brief Format the bodies of this process as lines of a TSV universe
+  /// file. Rank 0 starts with the line of the bodies count
+  /// @param text String where the lines are appended.
+  /// @param rank Rank of the formatting process.
+  /// @param totalBodyCount Number of bodies in the universe.
+  void formatBodiesFile(std::string& text, int rank, size_t totalBodyCount)
+    const;
+
+  /// @brief Format the bodies of this process as records of a binary
+  /// universe file. Rank 0 starts with the header
+  /// @param data String where the bytes are appended.
+  /// @param rank Rank of the formatting process.
+  /// @param totalBodyCount Number of bodies in the universe.
+  void formatBinaryFile(std::string& data, int rank, size_t totalBodyCount)
+    const;
 
   /// @brief Perform collision detection among local bodies.
   void checkCollisions();
@@ -97,63 +212,301 @@ class Universe {
   void checkCollisions(std::vector<double>& serializedBodies, const int rank,
       const int otherRank);
 
+ private:  // HELPER METHODS FOR LOCAL COLLISIONS
+  /// @brief Finds in parallel the pairs of local bodies that collide before
+  /// any merge happens
+  /// @param collisions Output, pairs (body, other body) sorted ascending.
+  /// Both orders of each pair are included
+  void detectCollisions(std::vector<std::pair<size_t, size_t>>& collisions);
+
+  /// @brief Merges colliding bodies in the same order as checking every pair
+  /// would, also finding collisions caused by radiuses grown in merges
+  /// @param collisions Pairs found by detectCollisions
+  void resolveCollisions(
+    const std::vector<std::pair<size_t, size_t>>& collisions);
+
  private:
   /// @brief Handles the collision between two bodies
-  /// @param body current body that has collided
+  /// @param index Index of the current body that has collided
   /// @param serializedBodies Serialized data of other bodies
   /// @param otherVelocity Velocity vector of the other body
   /// @param offset to index in the serialized data for the other body
   /// @param rank Rank of the current process
   /// @param otherRank Rank of the process sending the serialized data
-  void collideBodies(Body& body, std::vector<double>& serializedBodies,
+  void collideBodies(size_t index, std::vector<double>& serializedBodies,
     const RealVector& otherVelocity, const size_t offset, const int rank,
     const int otherRank);
+  /// @brief Set the active bodies count from the bodies themselves, once
+  /// their collisions are resolved
+  void countActiveBodies();
 
  public:
   /// @brief Update gravitational accelerations of all local bodies.
-  void updateAccelerations();
+  /// @param symmetric Evaluate each pair of local bodies once and apply it to
+  /// both, instead of computing every body's pull separately
+  /// @param progress If given, called by the master thread while the rest
+  /// of the team sweeps the bodies. Only without symmetric, whose rounds
+  /// need the whole team
+  void updateAccelerations(bool symmetric = false,
+    const std::function<void()>& progress = nullptr);
 
  private:  // HELPER METHODS FOR UPDATE ACCELERATION
-  /// @brief Resets bodies' accelerations to zeroes
-  /// @param tempBodies Temporary vector of bodies passed for omp
-  void resetAccelerations(std::vector<Body>& tempBodies);
+  /// @brief Resets bodies' accelerations to zeroes and masks the masses of
+  /// inactive bodies for the force kernel
+  /// @param tempBodies Temporary reference to the bodies passed for omp
+  void resetAccelerations(BodyStore& tempBodies);
 
   /// @brief Updates accelerations of bodies in local collection
   /// @see resetAccelerations
-  void updateLocalAccelerations(std::vector<Body>& tempBodies);
+  void updateLocalAccelerations(BodyStore& tempBodies);
+
+  /// @brief Updates accelerations of local bodies evaluating each pair once.
+  /// Pairs of blocks of bodies are distributed in rounds where no two pairs
+  /// share a block, so threads never write the same accelerations
+  /// @see resetAccelerations
+  void updateLocalAccelerationsSymmetric(BodyStore& tempBodies);
+
+  /// @brief Updates accelerations of active local bodies against sources,
+  /// distributing the local bodies among the threads of the current team.
+  /// If tile sizes are set, each thread takes a tile of local bodies and
+  /// sweeps it against one tile of sources at a time, so the sources stay in
+  /// cache
+  /// @param tempBodies Reference to the local bodies
+  /// @param sources ForceSources or FloatForceSources pulling on the bodies
+  template <typename Sources>
+  void sweepAccelerations(BodyStore& tempBodies, const Sources& sources);
+
+  /// @brief Get the blocks paired in a round of a round robin tournament
+  /// @param blockCount Even number of blocks
+  /// @param round Round in [0, blockCount[, the last pairs blocks with
+  /// themselves
+  /// @param pair Index of the pair in the round
+  /// @param first,second Output, blocks of the pair
+  static void getBlockPair(size_t blockCount, size_t round, size_t pair,
+    size_t& first, size_t& second);
 
  public:
+  /// @brief Compute direct accelerations with single precision distances
+  /// @param mixedPrecision True to use the single precision kernel for local
+  /// and single precision remote bodies, false for double precision
+  void setMixedPrecision(bool mixedPrecision) {
+    this->mixedPrecision = mixedPrecision;
+  }
+
+  /// @brief Keep the time bins of the bodies when they migrate
+  /// @param usesTimeBins True if the simulation uses block timesteps
+  void setTimeBins(bool usesTimeBins) {
+    this->usesTimeBins = usesTimeBins;
+  }
+
+  /// @brief Set the tile sizes of the direct force sweep
+  /// @param localTileSize Local bodies per tile, 0 disables tiling
+  /// @param sourceTileSize Source bodies per tile, 0 disables tiling
+  void setTileSizes(size_t localTileSize, size_t sourceTileSize) {
+    this->localTileSize = localTileSize;
+    this->sourceTileSize = sourceTileSize;
+  }
+
   /// @brief Update accelerations using remote body data
   /// @param serializedBodies Serialized positions and masses of other bodies.
-  void updateAccelerations(std::vector<double>& serializedBodies);
+  /// @param progress If given, called by the master thread while the rest
+  /// of the team sweeps the bodies, e.g. to progress transfers. The master
+  /// joins the sweep when it returns
+  void updateAccelerations(std::vector<double>& serializedBodies,
+    const std::function<void()>& progress = nullptr);
+
+  /// @brief Update accelerations using remote body data in single precision
+  /// @see updateAccelerations(std::vector<double>&, ...)
+  void updateAccelerations(std::vector<float>& serializedBodies,
+    const std::function<void()>& progress = nullptr);
+
+  /// @brief Update accelerations approximating with a Barnes-Hut octree
+  /// built over the local bodies and the bodies of every other process
+  /// @param serializedBodies Serialized positions and masses of the bodies
+  /// of all other processes
+  /// @param theta Opening angle, see Octree
+  void updateAccelerationsBarnesHut(
+    const std::vector<double>& serializedBodies, double theta);
 
   /// @brief update velocities and positions for local bodies
   /// @param deltaTime duration between updates
-  void updateVelocitiesAndPositions(double deltaTime);
+  /// @param kickTime duration the acceleration acts on the velocity, before
+  /// the velocity moves the body. Usually deltaTime, half of it for the
+  /// first step of leapfrog
+  void updateVelocitiesAndPositions(double deltaTime, double kickTime);
+
+  /// @brief update velocities of local bodies, without moving them
+  /// @param kickTime duration the acceleration acts on the velocity
+  void updateVelocities(double kickTime);
+
+ public:  // BLOCK TIMESTEPS
+  /// @brief Start a block step of deltaTime, split in 2^maxBin sub-steps.
+  /// Closes the step each body was in, places it in a new bin and opens its
+  /// next step with half a kick. Accelerations of all bodies must be updated
+  /// @param closeSteps False in the first block step, where velocities are
+  /// still at the time of positions
+  /// @param deltaTime Duration of the block step, the step of bin 0
+  /// @param maxBin Deepest bin, with steps of deltaTime / 2^maxBin
+  /// @param eta Accuracy factor, see chooseTimeBin
+  void startTimeBins(bool closeSteps, double deltaTime, int maxBin,
+    double eta);
+
+  /// @brief Keep a copy of the bodies of other processes, so they can be
+  /// drifted locally and only velocity changes have to be sent
+  /// @param serializedBodies Collision data of all processes, see
+  /// serializeCollisionData. Must be serialized after startTimeBins
+  /// @param offsets Start of the data of each process, plus the end
+  /// @param rank Rank of this process, whose data is skipped
+  void setMirror(const std::vector<double>& serializedBodies,
+    const std::vector<int>& offsets, int rank);
+
+  /// @brief Move local and mirrored bodies with their current velocities
+  /// @param time Duration of the drift, a whole number of sub-steps
+  void driftTimeBins(double time);
+
+  /// @brief Update accelerations of the bodies whose step ends at a sub-step,
+  /// against local and mirrored bodies, then close their step, place them in
+  /// a new bin and open their next step
+  /// @param subStep Sub-steps elapsed in the block, where a body in bin k
+  /// ends a step every 2^(maxBin - k) sub-steps
+  /// @see startTimeBins for the other params
+  /// @param changes Output, velocity changes of the bodies advanced as
+  /// (position in the last serializeCollisionData, x, y, z)
+  void advanceTimeBins(size_t subStep, double deltaTime, int maxBin,
+    double eta, std::vector<double>& changes);
+
+  /// @brief Apply the velocity changes of other processes to the mirror
+  /// @param changes Velocity changes of all processes, see advanceTimeBins
+  /// @param offsets Start of the changes of each process, plus the end
+  /// @param rank Rank of this process, whose changes are skipped
+  void applyMirrorChanges(const std::vector<double>& changes,
+    const std::vector<int>& offsets, int rank);
+
+  /// @brief Close the step of every body at the end of the last block step.
+  /// Accelerations of all bodies must be updated
+  /// @param deltaTime Duration of the block step
+  void finishTimeBins(double deltaTime);
+
+  /// @brief Get the deepest bin among active local bodies
+  /// @return The bin, 0 if there are no active bodies
+  int getDeepestTimeBin() const;
 
- public:
-  /// @brief Compute all pairwise distances between active local bodies.
+ private:
+  /// @brief Fill the mirror in a single thread, see setMirror
+  void loadMirror(const std::vector<double>& serializedBodies,
+    const std::vector<int>& offsets, int rank);
+
+  /// @brief Choose the bin of a body from its acceleration a and radius r,
+  /// as the coarsest whose step is at most eta * sqrt(r / |a|), the time the
+  /// pull takes to move the body a fraction of its own size
+  /// @see startTimeBins for the other params
+  /// @return Bin in [0, maxBin]
+  int chooseTimeBin(size_t index, double deltaTime, int maxBin,
+    double eta) const;
+
+ public:  // LOAD BALANCING
+  /// @brief Take the inactive bodies out of the arrays and spread the active
+  /// ones evenly among processes, keeping their order in the universe.
+  /// Collective, single thread
   /// @param mpi MPI interface object.
-  /// @return Vector of distance vectors.
-  std::vector<RealVector> getMyDistances(Mpi* mpi);
+  void rebalance(Mpi* mpi);
 
-  /// @brief Get all local velocities of active bodies.
-  /// @return Vector of velocity vectors.
-  std::vector<RealVector> getMyVelocities() const;
+  /// @brief Take the inactive bodies out of the arrays, sort the active ones
+  /// along a Morton curve over the box that holds them, and split the curve
+  /// evenly among processes. Bodies close in space end up close in memory
+  /// and in the same process. Collective, single thread
+  /// @param mpi MPI interface object.
+  void sortMorton(Mpi* mpi);
+
+  /// @brief Take the inactive bodies out of the arrays, keeping the order of
+  /// the active ones, if they are more than a fraction of the stored bodies.
+  /// Later sweeps only go over bodies still alive. Single thread
+  /// @param threshold Fraction of inactive bodies that triggers compaction
+  void compact(double threshold);
+
+  /// @brief Serialize every body of this process, including the ones taken
+  /// out of the arrays, to save them in a checkpoint. Single thread
+  /// @param serialized Vector where the MigrationData is added
+  void serializeCheckpoint(std::vector<double>& serialized) const;
+
+  /// @brief Copy the positions of the active bodies whose id is a multiple of
+  /// a stride, to save them in a trajectory frame. Single thread
+  /// @param stride Keep one body of every this many in the universe file
+  /// @param ids Vector where the ids of the bodies are added
+  /// @param positions Vector where x, y and z of each body are added
+  void serializeTrajectory(size_t stride, std::vector<uint32_t>& ids,
+    std::vector<double>& positions) const;
+
+  /// @brief Replace the local bodies with the ones of a checkpoint, in the
+  /// order of the universe file. Single thread
+  /// @param serialized Bodies as MigrationData, in any order, consumed
+  void loadCheckpoint(std::vector<double>& serialized);
+
+  /// @brief Return every body, including the ones taken out of the arrays,
+  /// to the process and position it was loaded in. Collective, single thread
+  /// @param mpi MPI interface object.
+  /// @param totalBodyCount Number of bodies in the universe.
+  void restoreHomeOrder(Mpi* mpi, size_t totalBodyCount);
+
+ private:
+  /// @brief Serialize a body to move it to another process
+  /// @param index Index of the body
+  /// @param serialized Vector where the MigrationData is added
+  void serializeMigrationData(size_t index, std::vector<double>& serialized)
+    const;
+
+  /// @brief Interleave the bits of a cell coordinate with two zeroes each
+  /// @param value Coordinate along one axis, in [0, MORTON_CELLS[
+  /// @return Bits of the axis in a Morton key
+  static uint64_t spreadBits(uint64_t value);
+
+  /// @brief Sort bodies serialized as MigrationData
+  /// @param serialized Records to sort, in place
+  /// @param less Strict order between two records
+  static void sortMigrationData(std::vector<double>& serialized,
+    const std::function<bool(const double*, const double*)>& less);
+
+  /// @brief Replace the local bodies with the given ones, and their time
+  /// bins if usesTimeBins
+  /// @param serialized Bodies as MigrationData, in their new order
+  void loadMigrationData(const std::vector<double>& serialized);
+
+ public:
+  /// @brief Accumulate all pairwise distances between active bodies, of
+  /// this process against itself and against the processes before it.
+  /// Each pair adds the position of its first body in the universe file
+  /// minus the other one's. Bodies must be in the order of the universe file
+  /// @param mpi MPI interface object.
+  /// @return Moments of the distance vectors.
+  Statistics::Moments getMyDistances(Mpi* mpi);
+
+  /// @brief Accumulate the positions of the active local bodies, to compute
+  /// the moments of their distances in closed form, see
+  /// Statistics::pairwiseMomentsDistributed. Bodies must be in the order of
+  /// the universe file
+  /// @param positions Moments where the positions are added.
+  /// @param rankedSum Sum of the positions, each multiplied by the number of
+  /// active local bodies before it.
+  void getMyPositions(Statistics::Moments& positions, RealVector& rankedSum)
+    const;
+
+  /// @brief Accumulate all local velocities.
+  /// @return Moments of the velocity vectors.
+  Statistics::Moments getMyVelocities() const;
 
  private:
   /// @brief Serialize the position vectors of all bodies.
   /// @param serializedPositions Vector to store serialized data.
   void serializePositions(std::vector<double>& serializedPositions);
 
-  /// @brief Compute all pairwise distances among local active bodies.
-  /// @param distances Output vector of computed distances.
-  void aggregateOwnDistances(std::vector<RealVector>& distances);
+  /// @brief Accumulate all pairwise distances among local active bodies.
+  /// @param distances Moments where the distances are added.
+  void aggregateOwnDistances(Statistics::Moments& distances);
 
   /// @brief Distances between local bodies and remote serialized positions.
-  /// @param distances Output vector of computed distances.
+  /// @param distances Moments where the distances are added.
   /// @param serializedPositions Serialized positions from another process.
-  void aggregateDistances(std::vector<RealVector>& distances,
+  void aggregateDistances(Statistics::Moments& distances,
     const std::vector<double>& serializedPositions);
 
  public:
@@ -163,18 +516,11 @@ class Universe {
     return this->bodies.size();
   }
 
-  /// @brief Access a body by index (non-const).
-  /// @param index Index of the body.
-  /// @return Reference to the body.
-  Body& operator[](size_t index) {
-    return this->bodies[index];
-  }
-
-  /// @brief Access a body by index (const).
+  /// @brief Access a view of a body by index.
   /// @param index Index of the body.
-  /// @return Constant reference to the body.
-  const Body& operator[](size_t index) const {
-    return this->bodies[index];
+  /// @return Copy of the body's properties.
+  Body operator[](size_t index) const {
+    return this->bodies.getBody(index);
   }
 
   /// @brief Get the number of active bodies.
@@ -184,8 +530,8 @@ class Universe {
   }
 
   /// @brief Get all local bodies.
-  /// @return Const reference to the vector of bodies.
-  const std::vector<Body>& getBodies() const {
+  /// @return Const reference to the body store.
+  const BodyStore& getBodies() const {
     return this->bodies;
   }
 };
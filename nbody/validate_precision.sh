@@ -0,0 +1,53 @@
+#!/bin/bash
+
+# Compares the final state of a universe simulated with double and with mixed
+# precision accelerations, reporting the largest relative difference of each
+# column. Usage: validate_precision.sh [universe delta_t max_time [processes]]
+# The launcher can be replaced through MPIEXEC, e.g. MPIEXEC="mpiexec -x VAR"
+
+universe=${1:-universes/univ002.tsv}
+delta_t=${2:-60}
+max_time=${3:-7200}
+processes=${4:-1}
+
+# Each run writes its result next to a copy of the universe
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+for precision in double mixed; do
+  mkdir "$workdir/$precision"
+  cp "$universe" "$workdir/$precision/universe.tsv"
+  ${MPIEXEC:-mpiexec} -np "$processes" bin/nbody \
+    "$workdir/$precision/universe.tsv" "$delta_t" "$max_time" \
+    --precision=$precision \
+    > "$workdir/$precision/report.txt" || exit 1
+done
+
+echo "Double precision report:"
+cat "$workdir/double/report.txt"
+echo "Mixed precision report:"
+cat "$workdir/mixed/report.txt"
+
+# Skip the count of bodies in the first line, then compare cell by cell
+paste "$workdir"/double/universe-*.tsv "$workdir"/mixed/universe-*.tsv \
+  | awk -F '\t' '
+    NR > 1 {
+      columns = NF / 2
+      for (column = 1; column <= columns; ++column) {
+        expected = $column
+        actual = $(column + columns)
+        scale = expected < 0 ? -expected : expected
+        difference = actual - expected
+        difference = difference < 0 ? -difference : difference
+        relative = scale > 0 ? difference / scale : difference
+        if (relative > largest[column]) {
+          largest[column] = relative
+        }
+      }
+    }
+    END {
+      split("mass radius pos_x pos_y pos_z vel_x vel_y vel_z", names, " ")
+      print "Largest relative difference per column:"
+      for (column = 1; column <= columns; ++column) {
+        printf "  %-7s %g\n", names[column], largest[column]
+      }
+    }'